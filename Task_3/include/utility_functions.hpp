@@ -16,6 +16,7 @@
 #include <stack>
 #include <list>
 #include <set>
+#include <limits>
 
 namespace pt = boost::property_tree;
 namespace po = boost::program_options;
@@ -24,6 +25,10 @@ namespace po = boost::program_options;
 boost::property_tree::ptree json_to_machine(const std::string& json_path);
 int sequences_to_file(const std::string& output_file, const std::vector<std::vector<std::string>>& sequences);
 
+// разделитель входного и выходного символа в парном формате (--with-outputs): z1/w2,z2/w1
+constexpr char io_separator = '/';
+std::string make_sequence_item(const std::string& input_symbol, const std::string& output_symbol, bool with_outputs);
+
 // для режима states
 bool length_comparator_greater(const std::vector<std::string>& a, const std::vector<std::string>& b);
 std::vector<std::vector<std::string>> remove_pyramidal_subduplicates(const std::vector<std::vector<std::string>>& sequences);
@@ -98,17 +103,40 @@ bool has_non_empty_vectors(const std::unordered_map<std::string, std::vector<Tra
 bool all_singles_used(const std::vector<std::list<Transition>>& chains_of_singles, const std::unordered_set<std::list<Transition>, Transition::ListHash>& used_single_chains);
 bool all_multies_used(const std::unordered_map<std::string, std::vector<Transition>>& multi_branched, const std::unordered_set<std::string>& used_multi_branches);
 
-std::vector<std::list<Transition>> connect_everything(std::unordered_map<std::string, std::vector<Transition>>& multi_branched, std::vector<std::list<Transition>>& chains_of_singles, const std::string& initial_state);
+std::vector<std::list<Transition>> connect_everything(const std::unordered_map<std::string, std::vector<Transition>>& multi_branched, const std::vector<std::list<Transition>>& chains_of_singles, const std::string& initial_state);
 
 bool is_sublist(const std::list<Transition>& sub, const std::list<Transition>& full);
 void remove_sublists(std::vector<std::list<Transition>>& sequences);
 
 bool all_transitions_present(const std::vector<Transition>& transitions, const std::vector<std::list<Transition>>& result_sequences);
 std::vector<std::list<Transition>> filter(const std::vector<std::list<Transition>>& unfiltered_sequences, const std::vector<Transition>& all_transitions);
+std::vector<std::string> transitions_to_sequence(const std::list<Transition>& transitions, bool with_outputs);
 std::unordered_set<std::string> get_all_states(const pt::ptree& machine);
 
 // для режима paths
 void remove_non_unique_substrings(std::vector<std::vector<std::string>>& sequences);
 int find_max_path_len(const pt::ptree& transitions, const std::string& current_state, std::unordered_map<std::string, int>& memo, int input_length, std::unordered_set<std::string>& visited);
 std::vector<Transition> find_transitions_from_state(const pt::ptree& machine, const std::string& state);
+
+// общий разбор автомата: выполняется один раз и используется всеми режимами (--mode states,transitions,paths:4)
+struct MachineAnalysis {
+    std::string initial_state;
+    std::vector<Transition> transitions;
+    std::unordered_map<std::string, std::vector<Transition>> grouped_transitions;
+
+    // только для режима transitions
+    std::vector<std::list<Transition>> loops_and_singles;
+    std::unordered_map<std::string, std::vector<Transition>> multi_branched;
+};
+
+MachineAnalysis analyse_machine(const pt::ptree& machine, bool with_chains);
+const std::vector<Transition>& find_transitions_from_state(const MachineAnalysis& analysis, const std::string& state);
+
+struct ModeRequest {
+    std::string mode;
+    unsigned int path_len;
+};
+
+std::vector<ModeRequest> parse_modes(const std::string& modes, unsigned int default_path_len);
+std::string mode_output_file(const std::string& output_file, const ModeRequest& request, bool several_modes);
 #endif
\ No newline at end of file
@@ -1,13 +1,11 @@
 #include "utility_functions.hpp"
+#include "transition_store.hpp"
 
-auto generate_state_sequences(const pt::ptree& machine, std::vector<std::vector<std::string>>& sequences) {
-
-    auto initial_state = machine.get<std::string>("initial_state");
-    auto initial_transitions = machine.get_child_optional("transitions");
+auto generate_state_sequences(const MachineAnalysis& analysis, std::vector<std::vector<std::string>>& sequences, bool with_outputs) {
 
     std::unordered_set<std::string> states;
     std::stack<std::pair<std::string, std::vector<std::string>>> stack;
-    stack.push({initial_state, {}});
+    stack.push({analysis.initial_state, {}});
 
     while (!stack.empty()) {
         auto [current_state, current_sequence] = stack.top();
@@ -20,66 +18,40 @@ auto generate_state_sequences(const pt::ptree& machine, std::vector<std::vector<
         states.insert(current_state);
         sequences.push_back(current_sequence);
 
-        auto transitions = machine.get_child_optional("transitions." + current_state);
-
-        if (!transitions) {
-            continue;
-        }
-
-        for (const auto& transition : *transitions) {
-            const auto& input = transition.first;
-            const auto& transition_data = transition.second;
-            std::string next_state = transition_data.get<std::string>("state");
-
+        for (const auto& transition : find_transitions_from_state(analysis, current_state)) {
             std::vector<std::string> new_sequence = current_sequence;
-            new_sequence.push_back(input);
-            stack.push({next_state, new_sequence});
+            new_sequence.push_back(make_sequence_item(transition.input_symbol, transition.output_symbol, with_outputs));
+            stack.push({transition.next_state, new_sequence});
         }
     }
 }
 
-auto generate_transition_sequences(const pt::ptree& machine, std::vector<std::vector<std::string>>& sequences) {
+auto generate_transition_sequences(const MachineAnalysis& analysis, std::vector<std::vector<std::string>>& sequences, bool with_outputs) {
 
     // тривиальный случай
-    auto states = get_all_transitions(machine);
-    if (states.size() == 0) {
+    if (analysis.transitions.size() == 0) {
         return 0;
     }
 
-    // Этап #1: Подготовка цепочек
-    auto transitions = get_all_transitions(machine);
-    auto grouped_transitions = group_transitions_by_state(transitions);
-
-    auto singles = find_single_branched_transitions(grouped_transitions);
-    auto self_loops_chains = find_and_group_self_loops(transitions);
-    auto loops_and_singles = merge_loops_and_singles(singles, self_loops_chains);
-
+    // Этап #1: Подготовка цепочек (выполнена в analyse_machine)
     // Этап #2: Связывание цепочек
-    auto multi_branched = find_multi_branched_transitions(grouped_transitions);
-    auto initial_state = machine.get<std::string>("initial_state");
-    auto result_sequences = connect_everything(multi_branched, loops_and_singles, initial_state);
+    auto result_sequences = connect_everything(analysis.multi_branched, analysis.loops_and_singles, analysis.initial_state);
 
     // Этап #3: фильтрация последовательностей и проверка покрытия всех состояний
     remove_sublists(result_sequences);
-    auto final_sequences = filter(result_sequences, transitions);
+    auto final_sequences = filter(result_sequences, analysis.transitions);
 
-    // Этап #4: построение итоговых последовательностей выходных символов
+    // Этап #4: построение итоговых последовательностей (входные символы, при with_outputs - пары вход/выход)
     for (const auto& transition_list : final_sequences) {
-        std::vector<std::string> string_vector;
-        for (const auto& transition : transition_list) {
-            std::stringstream ss;
-            ss << transition.input_symbol;
-            string_vector.push_back(ss.str());
-        }
-        sequences.push_back(string_vector);
+        sequences.push_back(transitions_to_sequence(transition_list, with_outputs));
     }
 
     return 0;
 }
 
-auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector<std::vector<std::string>>& sequences) {
-    auto initial_state = machine.get<std::string>("initial_state");
-    auto transitions = machine.get_child("transitions");
+auto generate_path_sequences(const pt::ptree& machine, const MachineAnalysis& analysis, int path_len, std::vector<std::vector<std::string>>& sequences, bool with_outputs) {
+    const auto& initial_state = analysis.initial_state;
+    const auto& transitions = machine.get_child("transitions");
 
     // изначально нужно подсчитать валидную длину путей
     std::unordered_map<std::string, int> memo;
@@ -93,9 +65,9 @@ auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector
     std::unordered_set<std::list<Transition>, Transition::ListHash> incomplete_and_deadending_paths;
 
     // начальное состояние есть всегда, поэтому его можно добавить
-    auto initial_trs = find_transitions_from_state(machine, initial_state);
+    const auto& initial_trs = find_transitions_from_state(analysis, initial_state);
     if (real_max_path_len != 1) {
-        for (auto& trs : initial_trs) {
+        for (const auto& trs : initial_trs) {
             tmp_paths.push_back({trs});
         }
     } else {
@@ -103,17 +75,11 @@ auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector
             auto msg = "No transitions available for state " + initial_state + "\n";
             throw std::runtime_error(msg);
         }
-        for (auto& trs : initial_trs) {
+        for (const auto& trs : initial_trs) {
             result_paths.push_back({trs});
         }
         for (const auto& transition_list : result_paths) {
-            std::vector<std::string> string_vector;
-            for (const auto& transition : transition_list) {
-                std::stringstream ss;
-                ss << transition.input_symbol;
-                string_vector.push_back(ss.str());
-            }
-            sequences.push_back(string_vector);
+            sequences.push_back(transitions_to_sequence(transition_list, with_outputs));
         }
         return 0;
     }
@@ -126,9 +92,9 @@ auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector
             auto it_f = incomplete_and_deadending_paths.find(path);
             if (it_f == incomplete_and_deadending_paths.end()) {
                 auto ending = path.back().next_state;
-                auto ending_trs = find_transitions_from_state(machine, ending);
+                const auto& ending_trs = find_transitions_from_state(analysis, ending);
                 if (!ending_trs.empty() && i < real_max_path_len - 1) {
-                    for (auto& end : ending_trs) {
+                    for (const auto& end : ending_trs) {
                         auto new_path = path;
                         new_path.push_back(end);
                         new_paths.push_back(new_path);
@@ -137,7 +103,7 @@ auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector
                     if (ending_trs.empty()) {
                         result_paths.push_back(path);
                     } else {
-                        for (auto& end : ending_trs) {
+                        for (const auto& end : ending_trs) {
                             auto new_path = path;
                             new_path.push_back(end);
                             result_paths.push_back(new_path);
@@ -150,30 +116,75 @@ auto generate_path_sequences(const pt::ptree& machine, int path_len, std::vector
         tmp_paths.insert(tmp_paths.end(), new_paths.begin(), new_paths.end());
     }
 
-    // построение итоговых последовательностей выходных символов
+    // построение итоговых последовательностей (входные символы, при with_outputs - пары вход/выход)
     for (const auto& transition_list : result_paths) {
-        std::vector<std::string> string_vector;
-        for (const auto& transition : transition_list) {
-            std::stringstream ss;
-            ss << transition.input_symbol;
-            string_vector.push_back(ss.str());
-        }
-        sequences.push_back(string_vector);
+        sequences.push_back(transitions_to_sequence(transition_list, with_outputs));
     }
 
     return 0;
 }
 
+// режим states для автомата во внешней памяти: дерево обхода в ширину (родитель и вход для каждого состояния)
+// хранится в отображенном файле, последовательности - пути от корня до листьев дерева, пишутся сразу в файл
+int generate_store_state_sequences(const TransitionStore& store, const std::string& work_dir, const std::string& output_file, bool with_outputs) {
+    struct TreeEdge {
+        std::uint32_t parent;
+        std::uint32_t input;
+    };
+
+    auto returned = 0;
+    {
+        TemporaryDirectory temporary(work_dir);
+        MappedArrayFile tree_file(temporary.path("bfs_tree.bin"), static_cast<std::size_t>(store.n_states()) * sizeof(TreeEdge));
+        auto* tree = static_cast<TreeEdge*>(tree_file.data());
+        DiskBitset reached(temporary.path("bfs_reached.bits"), store.n_states());
+        DiskBitset inner(temporary.path("bfs_inner.bits"), store.n_states());
+
+        external_bfs(store, work_dir, [&](std::uint32_t state, std::uint32_t parent, std::uint32_t input) {
+            tree[state] = {parent, input};
+            reached.set(state);
+            if (parent != no_transition) {
+                inner.set(parent);
+            }
+        });
+
+        std::ofstream file(output_file);
+        if (!file.is_open()) {
+            std::cerr << "Error opening output file!!!" << std::endl;
+            returned = 2;
+        }
+        std::vector<std::string> sequence;
+        for (std::uint32_t state = 0; returned == 0 && state < store.n_states(); ++state) {
+            if (!reached.test(state) || inner.test(state)) {
+                continue;
+            }
+            sequence.clear();
+            for (auto current = state; tree[current].parent != no_transition; current = tree[current].parent) {
+                const auto& edge = tree[current];
+                sequence.push_back(make_sequence_item(store.input_names()[edge.input], store.output_names()[store.step(edge.parent, edge.input).output], with_outputs));
+            }
+            for (size_t i = sequence.size(); i > 0; --i) {
+                file << sequence[i - 1] << (i > 1 ? "," : "");
+            }
+            file << "\n";
+        }
+    }
+    return returned;
+}
+
 int main(int argc, char* argv[]) {
     try {
 
         std::string mode;
-        unsigned int path_len;
+        unsigned int path_len = 0;
         std::string input_file;
         std::string output_file;
+        bool with_outputs = false;
+        std::string store_directory;
+        std::string work_dir;
 
         po::options_description desc("Allowed options");
-        desc.add_options()("help", "produce help message")("mode", po::value<std::string>(&mode)->required(), "working mode (states/transitions/paths)")("path-len", po::value<unsigned int>(&path_len), "length of the path in paths mode")("input-file", po::value<std::string>(&input_file)->required(), "input JSON file path")("out", po::value<std::string>(&output_file)->required(), "output file path");
+        desc.add_options()("help", "produce help message")("mode", po::value<std::string>(&mode)->required(), "working mode (states/transitions/paths), several modes can be combined in one pass: states,transitions,paths:4")("path-len", po::value<unsigned int>(&path_len), "length of the path in paths mode")("input-file", po::value<std::string>(&input_file), "input JSON file path")("out", po::value<std::string>(&output_file)->required(), "output file path (prefix for <out>_s.txt/<out>_t.txt/<out>_p.txt if several modes are set)")("with-outputs", po::bool_switch(&with_outputs), "write paired input/output symbols (input/output) instead of inputs only")("store", po::value<std::string>(&store_directory), "use a machine kept in an external-memory transition store instead of JSON (states mode only)")("work-dir", po::value<std::string>(&work_dir), "directory for BFS temporary files in --store mode (default: the store directory)");
 
         po::positional_options_description p;
         p.add("input-file", 1);
@@ -188,31 +199,49 @@ int main(int argc, char* argv[]) {
 
         po::notify(vm);
 
-        pt::ptree readed_machine = json_to_machine(input_file);
+        // автомат во внешней памяти: таблица не загружается целиком, поддерживается только режим states
+        if (!store_directory.empty()) {
+            if (mode != "states") {
+                throw std::invalid_argument("--store supports only states mode");
+            }
+            TransitionStore store(store_directory);
+            return generate_store_state_sequences(store, work_dir.empty() ? store_directory : work_dir, output_file, with_outputs);
+        }
+        if (input_file.empty()) {
+            throw std::invalid_argument("Input JSON file must be specified");
+        }
 
-        std::vector<std::vector<std::string>> sequences;
-        if (mode == "states") {
+        auto requests = parse_modes(mode, path_len);
+        auto with_chains = std::any_of(requests.begin(), requests.end(), [](const ModeRequest& request) {
+            return request.mode == "transitions";
+        });
 
-            generate_state_sequences(readed_machine, sequences);
-            sequences = remove_pyramidal_subduplicates(sequences);
+        // автомат читается и разбирается один раз для всех режимов
+        pt::ptree readed_machine = json_to_machine(input_file);
+        auto analysis = analyse_machine(readed_machine, with_chains);
+
+        for (const auto& request : requests) {
+            std::vector<std::vector<std::string>> sequences;
+            if (request.mode == "states") {
 
-        } else if (mode == "transitions") {
+                generate_state_sequences(analysis, sequences, with_outputs);
+                sequences = remove_pyramidal_subduplicates(sequences);
 
-            generate_transition_sequences(readed_machine, sequences);
+            } else if (request.mode == "transitions") {
 
-        } else if (mode == "paths") {
+                generate_transition_sequences(analysis, sequences, with_outputs);
 
-            if (path_len <= 0) {
+            } else {
 
-                throw std::invalid_argument("Path length must be positive in paths mode");
+                generate_path_sequences(readed_machine, analysis, request.path_len, sequences, with_outputs);
+                remove_non_unique_substrings(sequences);
             }
-            generate_path_sequences(readed_machine, path_len, sequences);
-            remove_non_unique_substrings(sequences);
 
-        } else {
-            throw std::invalid_argument("Invalid mode: " + mode + ". There're only 3 modes: states/transitions/paths");
+            auto returned = sequences_to_file(mode_output_file(output_file, request, requests.size() > 1), sequences);
+            if (returned != 0) {
+                return returned;
+            }
         }
-        sequences_to_file(output_file, sequences);
 
     } catch (const po::error& e) {
         std::cerr << "Command line error: " << e.what() << "\n";
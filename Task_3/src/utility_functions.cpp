@@ -27,6 +27,13 @@ int sequences_to_file(const std::string& output_file, const std::vector<std::vec
     return 0;
 }
 
+std::string make_sequence_item(const std::string& input_symbol, const std::string& output_symbol, bool with_outputs) {
+    if (!with_outputs) {
+        return input_symbol;
+    }
+    return input_symbol + io_separator + output_symbol;
+}
+
 bool length_comparator_greater(const std::vector<std::string>& a, const std::vector<std::string>& b) {
     return a.size() > b.size();
 }
@@ -477,7 +484,7 @@ bool all_multies_used(const std::unordered_map<std::string, std::vector<Transiti
     return true;
 }
 
-std::vector<std::list<Transition>> connect_everything(std::unordered_map<std::string, std::vector<Transition>>& multi_branched, std::vector<std::list<Transition>>& chains_of_singles, const std::string& initial_state) {
+std::vector<std::list<Transition>> connect_everything(const std::unordered_map<std::string, std::vector<Transition>>& multi_branched, const std::vector<std::list<Transition>>& chains_of_singles, const std::string& initial_state) {
     std::vector<std::list<Transition>> result;
     std::unordered_set<std::list<Transition>, Transition::ListHash> used_single_chains;
     std::unordered_set<std::string> used_multi_branches;
@@ -670,6 +677,15 @@ std::vector<std::list<Transition>> filter(const std::vector<std::list<Transition
     return filtered_sequences;
 }
 
+std::vector<std::string> transitions_to_sequence(const std::list<Transition>& transitions, bool with_outputs) {
+    std::vector<std::string> sequence;
+    sequence.reserve(transitions.size());
+    for (const auto& transition : transitions) {
+        sequence.push_back(make_sequence_item(transition.input_symbol, transition.output_symbol, with_outputs));
+    }
+    return sequence;
+}
+
 void remove_non_unique_substrings(std::vector<std::vector<std::string>>& sequences) {
     std::unordered_set<std::string> unique_sequences;
 
@@ -757,4 +773,89 @@ std::vector<Transition> find_transitions_from_state(const pt::ptree& machine, co
     }
 
     return transitions;
-}
\ No newline at end of file
+}
+
+MachineAnalysis analyse_machine(const pt::ptree& machine, bool with_chains) {
+    MachineAnalysis analysis;
+    analysis.initial_state = machine.get<std::string>("initial_state");
+    analysis.transitions = get_all_transitions(machine);
+    analysis.grouped_transitions = group_transitions_by_state(analysis.transitions);
+
+    // подготовка цепочек одноразветвленных/многоразветвленных нужна только режиму transitions
+    if (with_chains) {
+        auto singles = find_single_branched_transitions(analysis.grouped_transitions);
+        auto self_loops_chains = find_and_group_self_loops(analysis.transitions);
+        analysis.loops_and_singles = merge_loops_and_singles(singles, self_loops_chains);
+        analysis.multi_branched = find_multi_branched_transitions(analysis.grouped_transitions);
+    }
+
+    return analysis;
+}
+
+const std::vector<Transition>& find_transitions_from_state(const MachineAnalysis& analysis, const std::string& state) {
+    static const std::vector<Transition> no_transitions;
+
+    auto it = analysis.grouped_transitions.find(state);
+    if (it == analysis.grouped_transitions.end()) {
+        return no_transitions;
+    }
+    return it->second;
+}
+
+// разбор строки режимов вида states,transitions,paths:4 (для paths без длины берется --path-len)
+std::vector<ModeRequest> parse_modes(const std::string& modes, unsigned int default_path_len) {
+    std::vector<ModeRequest> result;
+    std::unordered_set<std::string> seen_modes;
+
+    std::istringstream iss(modes);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        ModeRequest request{item, 0};
+
+        auto colon = item.find(':');
+        if (colon != std::string::npos) {
+            request.mode = item.substr(0, colon);
+            if (request.mode != "paths") {
+                throw std::invalid_argument("Path length can be set only for paths mode: " + item);
+            }
+            // stoul принимает знак ("-1" превращается в огромную длину) и мусор после числа, поэтому допускаются только цифры
+            auto length = item.substr(colon + 1);
+            unsigned long path_len = 0;
+            try {
+                path_len = length.find_first_not_of("0123456789") == std::string::npos ? std::stoul(length) : 0;
+            } catch (const std::exception&) {
+            }
+            if (path_len == 0 || path_len > std::numeric_limits<unsigned int>::max()) {
+                throw std::invalid_argument("Invalid path length in mode: " + item);
+            }
+            request.path_len = static_cast<unsigned int>(path_len);
+        } else if (request.mode == "paths") {
+            request.path_len = default_path_len;
+        }
+
+        if (request.mode != "states" && request.mode != "transitions" && request.mode != "paths") {
+            throw std::invalid_argument("Invalid mode: " + request.mode + ". There're only 3 modes: states/transitions/paths");
+        }
+        if (request.mode == "paths" && request.path_len <= 0) {
+            throw std::invalid_argument("Path length must be positive in paths mode");
+        }
+        if (!seen_modes.insert(request.mode).second) {
+            throw std::invalid_argument("Mode is specified more than once: " + request.mode);
+        }
+
+        result.push_back(request);
+    }
+
+    if (result.empty()) {
+        throw std::invalid_argument("No working mode specified");
+    }
+    return result;
+}
+
+// при нескольких режимах --out задает префикс: <out>_s.txt, <out>_t.txt, <out>_p.txt (как в tests_coverages.sh)
+std::string mode_output_file(const std::string& output_file, const ModeRequest& request, bool several_modes) {
+    if (!several_modes) {
+        return output_file;
+    }
+    return output_file + "_" + request.mode.front() + ".txt";
+}
@@ -14,83 +14,538 @@
 #include <random>
 #include <vector>
 #include <list>
+#include <set>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
-struct Transition {
-    std::string current_state;
-    std::string next_state;
-    std::string input_symbol;
-    std::string output_symbol;
-
-    bool operator==(const Transition& other) const {
-        return current_state == other.current_state &&
-            next_state == other.next_state &&
-            input_symbol == other.input_symbol &&
-            output_symbol == other.output_symbol;
+#include "transition_store.hpp"
+
+namespace pt = boost::property_tree;
+namespace po = boost::program_options;
+
+// разделитель входного и выходного символа в парном формате (sequence_formation --with-outputs): z1/w2,z2/w1
+constexpr char io_separator = '/';
+
+pt::ptree json_to_machine(const std::string& json_path);
+
+// скомпилированный автомат: состояния, входные и выходные символы пронумерованы, переходы лежат в плоской таблице [state * n_inputs + input]
+// номер ячейки таблицы одновременно является номером перехода
+struct CompiledMachine {
+    std::vector<std::string> state_names;
+    std::vector<std::string> input_names;
+    std::vector<std::string> output_names;
+    std::unordered_map<std::string, std::uint32_t> state_ids;
+    std::unordered_map<std::string, std::uint32_t> input_ids;
+    std::unordered_map<std::string, std::uint32_t> output_ids;
+
+    std::uint32_t initial_state = 0;
+    std::uint32_t n_inputs = 0;
+    std::uint32_t n_transitions = 0;
+    std::vector<TableEntry> table;
+
+    std::uint32_t n_states() const { return static_cast<std::uint32_t>(state_names.size()); }
+    std::size_t transition_id(std::uint32_t state, std::uint32_t input) const { return static_cast<std::size_t>(state) * n_inputs + input; }
+    const TableEntry& step(std::uint32_t state, std::uint32_t input) const { return table[transition_id(state, input)]; }
+};
+
+CompiledMachine compile_machine(const pt::ptree& machine);
+// обратно в JSON-описание (тупиковые состояния - пустой строкой, как у генератора)
+pt::ptree machine_to_json(const CompiledMachine& machine);
+std::string transition_to_string(const CompiledMachine& machine, std::size_t transition);
+
+class Bitset {
+  public:
+    explicit Bitset(std::size_t size = 0);
+
+    void set(std::size_t index) { words[index >> 6] |= std::uint64_t{1} << (index & 63); }
+    bool test(std::size_t index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+
+    std::size_t size() const { return bits; }
+    std::size_t count() const;
+    void merge(const Bitset& other);
+
+  private:
+    std::vector<std::uint64_t> words;
+    std::size_t bits;
+};
+
+// компактное множество 64-битных хешей (открытая адресация, 0 - пустая ячейка)
+class HashSet64 {
+  public:
+    bool insert(std::uint64_t key);
+    std::size_t size() const { return count; }
+    void merge(const HashSet64& other);
+
+  private:
+    void grow();
+
+    std::vector<std::uint64_t> slots;
+    std::size_t count = 0;
+};
+
+// для режима paths: целевые пути - пути длины path_len из начального состояния
+// (или короче, если заканчиваются в тупиковом состоянии), path_len уже ограничена длиной самого длинного пути
+std::uint32_t effective_path_len(const CompiledMachine& machine, std::uint32_t path_len);
+std::uint64_t count_paths(const CompiledMachine& machine, std::uint32_t path_len);
+Bitset dead_end_states(const CompiledMachine& machine);
+
+// скользящее окно из path_len последних переходов (кольцевые буферы) с полиномиальным хешем
+struct PathWindow {
+    static constexpr std::uint64_t base = 0x9e3779b97f4a7c15ull;
+
+    std::uint32_t path_len = 0;
+    std::uint64_t power = 1; // base^path_len для удаления перехода, вышедшего из окна
+    Bitset dead_ends;
+    std::vector<std::uint32_t> sources;
+    std::vector<std::uint32_t> transitions;
+
+    PathWindow() = default;
+    PathWindow(const CompiledMachine& machine, std::uint32_t path_len);
+
+    // хеш окна: полиномиальный хеш номеров переходов с учетом длины окна
+    static std::uint64_t finish(std::uint64_t polynomial, std::uint32_t length) {
+        auto hash = polynomial + length * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+        return hash ^ (hash >> 31);
     }
+};
+
+// покрытие: посещенные состояния (по номеру состояния) и переходы (по номеру ячейки таблицы)
+// при count_hits дополнительно ведутся счетчики прохождений (для карт покрытия)
+// при path_len > 0 хеши окон путей, начинающихся в начальном состоянии, собираются в paths
+struct Coverage {
+    Bitset states;
+    Bitset transitions;
+
+    std::uint64_t sequences = 0;
+    std::vector<std::uint64_t> state_hits;
+    std::vector<std::uint64_t> transition_hits;
 
-    struct Hash {
-        std::size_t operator()(const Transition& t) const {
-            std::size_t h1 = std::hash<std::string>{}(t.current_state);
-            std::size_t h2 = std::hash<std::string>{}(t.next_state);
-            std::size_t h3 = std::hash<std::string>{}(t.input_symbol);
-            std::size_t h4 = std::hash<std::string>{}(t.output_symbol);
-            return h1 ^ (h2 << 1) ^ (h3 << 2) ^ (h4 << 3);
+    PathWindow window;
+    HashSet64 paths;
+
+    explicit Coverage(const CompiledMachine& machine, bool count_hits = false, std::uint32_t path_len = 0);
+    bool counts_hits() const { return !state_hits.empty(); }
+    std::uint32_t path_len() const { return window.path_len; }
+    void merge(const Coverage& other);
+
+    // отметки, вызываемые из replay_sequence
+    void mark_state(std::uint32_t state) {
+        states.set(state);
+        if (!state_hits.empty()) {
+            state_hits[state]++;
         }
-    };
+    }
+    void mark_transition(std::size_t transition) {
+        transitions.set(transition);
+        if (!transition_hits.empty()) {
+            transition_hits[transition]++;
+        }
+    }
+    void mark_path(std::uint64_t hash) { paths.insert(hash); }
+};
+
+// файл последовательностей, отображенный в память (читается последовательно, без копирования)
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + length; }
+    std::size_t size() const { return length; }
+
+  private:
+    const char* data;
+    std::size_t length;
+    bool mapped = false;
+    std::string buffer; // каналы и прочие нерегулярные файлы не отображаются, а читаются целиком
+};
+
+// интернирование символов "на лету": известные автомату символы получают его номера,
+// неизвестные - номера после них (такие входы при проигрывании дают ошибку, а выходы - несовпадение)
+class SymbolInterner {
+  public:
+    explicit SymbolInterner(const std::vector<std::string>& known_symbols);
+
+    SymbolInterner(const SymbolInterner&) = delete;
+    SymbolInterner& operator=(const SymbolInterner&) = delete;
+    SymbolInterner(SymbolInterner&&) = default;
+
+    std::uint32_t intern(std::string_view symbol);
+    const std::string& name(std::uint32_t id) const { return names[id]; }
+
+  private:
+    std::deque<std::string> names; // deque: string_view в ids не инвалидируются при добавлении
+    std::unordered_map<std::string_view, std::uint32_t> ids;
+};
+
+// последовательность из одной строки файла: номера входов и ожидаемых выходов (no_transition, если выход не указан)
+struct ParsedSequence {
+    std::size_t line = 0;
+    std::vector<std::uint32_t> inputs;
+    std::vector<std::uint32_t> outputs;
+    bool has_outputs = false;
+};
+
+// разбор последовательностей прямо в отображенном файле: запятые и переводы строк обрабатываются на месте,
+// буферы ParsedSequence переиспользуются, поэтому память не зависит от размера файла
+class SequenceReader {
+  public:
+    SequenceReader(const CompiledMachine& machine, const char* begin, const char* end, std::size_t first_line = 1);
 
-    struct ListHash {
-        std::size_t operator()(const std::list<Transition>& list) const {
-            std::size_t seed = list.size();
-            for (const auto& transition : list) {
-                seed ^= Transition::Hash{}(transition) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    // пустые строки пропускаются; false - конец данных
+    bool next(ParsedSequence& sequence);
+    // трасса реализации: по одному шагу вход/выход в строке, прогоны разделяются пустыми строками
+    bool next_trace(ParsedSequence& sequence);
+    std::size_t next_line() const { return line; }
+
+    const SymbolInterner& inputs() const { return input_symbols; }
+    const SymbolInterner& outputs() const { return output_symbols; }
+
+  private:
+    void parse_items(const char* item, const char* line_end, ParsedSequence& sequence);
+
+    const char* current;
+    const char* last;
+    std::size_t line;
+    SymbolInterner input_symbols;
+    SymbolInterner output_symbols;
+};
+
+enum class ReplayStatus {
+    ok,
+    no_transition,
+    output_mismatch
+};
+
+struct ReplayResult {
+    ReplayStatus status;
+    std::size_t position; // позиция ошибки в последовательности
+    std::uint32_t state;  // состояние, в котором произошла ошибка (или конечное состояние)
+};
+
+// проигрывание последовательности по таблице со сверкой ожидаемых выходов; marker получает
+// mark_state/mark_transition/mark_path для пройденных состояний, переходов и окон путей (если window задано)
+template <typename Marker>
+ReplayResult replay_sequence(const CompiledMachine& machine, const ParsedSequence& sequence, PathWindow* window, Marker& marker) {
+    auto state = machine.initial_state;
+    marker.mark_state(state);
+
+    auto path_len = window ? window->path_len : 0;
+    std::uint64_t polynomial = 0;
+
+    const auto& inputs = sequence.inputs;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (inputs[i] >= machine.n_inputs) {
+            return {ReplayStatus::no_transition, i, state};
+        }
+        auto transition = machine.transition_id(state, inputs[i]);
+        const auto& entry = machine.table[transition];
+        if (entry.next_state == no_transition) {
+            return {ReplayStatus::no_transition, i, state};
+        }
+        if (sequence.has_outputs && sequence.outputs[i] != no_transition && sequence.outputs[i] != entry.output) {
+            return {ReplayStatus::output_mismatch, i, state};
+        }
+        marker.mark_transition(transition);
+        marker.mark_state(entry.next_state);
+
+        // скользящее окно путей: добавляем переход, убираем вышедший из окна, отмечаем окна из начального состояния
+        if (path_len > 0) {
+            auto slot = i % path_len;
+            polynomial = polynomial * PathWindow::base + transition + 1;
+            if (i >= path_len) {
+                polynomial -= (window->transitions[slot] + std::uint64_t{1}) * window->power;
+            }
+            window->sources[slot] = state;
+            window->transitions[slot] = static_cast<std::uint32_t>(transition);
+            if (i + 1 >= path_len && window->sources[(i + 1) % path_len] == machine.initial_state) {
+                marker.mark_path(PathWindow::finish(polynomial, path_len));
             }
-            return seed;
         }
-    };
-};
+        state = entry.next_state;
+    }
 
-struct VectorHash {
-    std::size_t operator()(const std::vector<std::string>& v) const {
-        std::size_t seed = v.size();
-        for (const auto& str : v) {
-            seed ^= std::hash<std::string>{}(str) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    // пути короче path_len засчитываются, только если последовательность закончилась в тупике
+    if (path_len > 0 && window->dead_ends.test(state)) {
+        auto length = inputs.size();
+        for (size_t start = length > path_len - 1 ? length - (path_len - 1) : 0; start < length; ++start) {
+            if (window->sources[start % path_len] != machine.initial_state) {
+                continue;
+            }
+            std::uint64_t tail_polynomial = 0;
+            for (auto k = start; k < length; ++k) {
+                tail_polynomial = tail_polynomial * PathWindow::base + window->transitions[k % path_len] + 1;
+            }
+            marker.mark_path(PathWindow::finish(tail_polynomial, static_cast<std::uint32_t>(length - start)));
         }
-        return seed;
     }
+    return {ReplayStatus::ok, inputs.size(), state};
+}
+
+inline ReplayResult replay_sequence(const CompiledMachine& machine, const ParsedSequence& sequence, Coverage& coverage) {
+    coverage.sequences++;
+    return replay_sequence(machine, sequence, coverage.path_len() > 0 ? &coverage.window : nullptr, coverage);
+}
+
+std::string replay_error_message(const CompiledMachine& machine, const SequenceReader& reader, const ParsedSequence& sequence, const ReplayResult& result);
+
+// пакет последовательностей для многополосного исполнения: входы и ожидаемые выходы всех последовательностей
+// лежат подряд в общих массивах (no_transition - выход не сверяется), offsets[i] - начало i-й, offsets.back() - конец
+struct SequenceBatch {
+    static constexpr std::size_t capacity = 4096; // последовательностей в пакете
+
+    std::vector<std::uint32_t> inputs;
+    std::vector<std::uint32_t> outputs;
+    std::vector<std::uint64_t> offsets = {0};
+    std::vector<std::size_t> lines;
+
+    std::size_t size() const { return lines.size(); }
+    bool full() const { return size() >= capacity; }
+    void clear();
+    void add(const ParsedSequence& sequence);
+    // последовательность пакета обратно в ParsedSequence (для сообщений об ошибках)
+    ParsedSequence sequence(std::size_t index) const;
 };
 
-namespace std {
-template <>
-struct hash<Transition> {
-    size_t operator()(const Transition& t) const {
-        return hash<string>()(t.current_state) ^ hash<string>()(t.next_state) ^ hash<string>()(t.input_symbol) ^ hash<string>()(t.output_symbol);
-    }
+// набор команд для исполнителя: automatic - лучший из поддерживаемых процессором
+enum class SimdLevel {
+    automatic,
+    scalar,
+    avx2,
+    avx512
 };
-} // namespace std
 
-namespace pt = boost::property_tree;
-namespace po = boost::program_options;
+SimdLevel parse_simd_level(const std::string& name);
+SimdLevel resolve_simd_level(SimdLevel level);
 
-pt::ptree json_to_machine(const std::string& json_path);
-std::vector<std::vector<std::string>> read_sequences(const std::string& sequences_file);
-std::unordered_set<std::string> get_all_states(const pt::ptree& machine);
-std::unordered_set<Transition> get_all_transitions(const pt::ptree& machine);
+// многополосный исполнитель: 8 (AVX2) или 16 (AVX-512) последовательностей пакета идут одновременно в полосах вектора,
+// следующее состояние и выход читаются из таблицы сборкой (gather), завершившаяся полоса сразу получает следующую
+// последовательность; results[i] - как у replay_sequence, coverage (если задано) получает отметки состояний и переходов
+void run_lanes(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results, Coverage* coverage, SimdLevel level);
 
-using Path = std::vector<Transition>;
+struct ReplayOptions {
+    unsigned int jobs = 1;      // 0 - все аппаратные потоки
+    bool count_hits = false;    // счетчики прохождений для карты покрытия
+    std::uint32_t path_len = 0; // длина путей для покрытия путей (0 - не собирать)
+    SimdLevel simd = SimdLevel::automatic; // исполнитель для проигрывания без окон путей
+};
 
-struct PathHash {
-    std::size_t operator()(const Path& path) const {
-        std::size_t seed = path.size();
-        for (const auto& transition : path) {
-            seed ^= Transition::Hash{}(transition) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
+// потоковое проигрывание файла последовательностей в jobs потоков: файл делится на куски по границам строк,
+// каждый поток набирает свое покрытие, затем покрытия объединяются (OR); при ошибке сообщается о первой
+// по номеру строки последовательности независимо от планирования потоков
+Coverage replay_file(const CompiledMachine& machine, const std::string& sequences_file, const ReplayOptions& options);
+
+// первое расхождение выходов последовательности с автоматом (actual пуст, если перехода нет)
+struct Divergence {
+    std::size_t line;
+    std::size_t position;
+    std::string state;
+    std::string input;
+    std::string expected;
+    std::string actual;
+};
+
+struct ConformanceReport {
+    std::size_t sequences = 0;
+    std::vector<Divergence> divergences; // в порядке строк файла
+};
+
+// проверка соответствия: выходы каждой последовательности (или прогона трассы) сверяются с выходами автомата,
+// для каждой расходящейся последовательности сообщается первое расхождение
+ConformanceReport check_conformance(const CompiledMachine& machine, const std::string& sequences_file, unsigned int jobs, bool trace, SimdLevel simd = SimdLevel::automatic);
+std::string divergence_message(const Divergence& divergence);
+
+// карта покрытия: счетчики прохождений состояний и переходов, сохраняемые в компактном двоичном файле
+// и объединяемые между шардами/запусками; привязана к автомату через machine_hash
+struct CoverageMap {
+    std::uint64_t machine_hash = 0;
+    std::uint64_t sequences = 0;
+    std::vector<std::uint64_t> state_hits;      // по состояниям в порядке имен
+    std::vector<std::uint64_t> transition_hits; // по существующим переходам в порядке (имя состояния, имя входа)
+};
+
+std::uint64_t machine_hash(const CompiledMachine& machine);
+
+// каноническая форма: состояния перенумерованы обходом в ширину из начального состояния с входами в порядке имен,
+// недостижимые части добавляются следом (корень - состояние истоковой компоненты, дающее наименьшую запись);
+// совпадает у автоматов, отличающихся только именами состояний (кроме недостижимых частей с общими целями,
+// неразличимых по записи и входящим переходам: их порядок может зависеть от имен, и такие автоматы считаются разными).
+// Строка состояния: "<номер>:" и для каждого входа " <вход>-><номер цели>/<выход>"
+std::string canonical_form(const CompiledMachine& machine);
+
+struct Hash128 {
+    std::uint64_t low = 0;
+    std::uint64_t high = 0;
+
+    bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+    std::string to_string() const;
+};
+
+// MurmurHash3 x64 128
+Hash128 murmur3_128(const void* data, std::size_t length, std::uint32_t seed = 0);
+CoverageMap coverage_to_map(const CompiledMachine& machine, const Coverage& coverage);
+Coverage map_to_coverage(const CompiledMachine& machine, const CoverageMap& map);
+void merge_coverage_maps(CoverageMap& into, const CoverageMap& other);
+void write_coverage_map(const std::string& path, const CoverageMap& map);
+CoverageMap read_coverage_map(const std::string& path);
+Bitset required_states(const CompiledMachine& machine);
+void print_coverage_report(std::ostream& out, const CompiledMachine& machine, const Coverage& coverage);
+
+// запись автомата из JSON-описания в хранилище во внешней памяти: файл разбирается потоково в два прохода (без ptree
+// и скомпилированного автомата), строки состояний пишутся по мере чтения; в памяти остается только словарь имен состояний
+// (для номеров целей переходов). Нумерация - как у compile_machine; состояние, описанное дважды, - ошибка
+void json_to_store(const std::string& json_path, const std::string& directory, std::uint32_t shard_states);
+
+// проверка покрытия автомата во внешней памяти (режимы states/transitions): карты покрытия - DiskBitset во временном каталоге внутри work_dir,
+// переходы при проигрывании читаются из отображенных шардов, обязательные и непокрытые элементы ищутся
+// последовательным проходом по шардам; сообщения об ошибках - как у проверок для скомпилированного автомата
+void check_store_coverage(const TransitionStore& store, const std::string& sequences_file, const std::string& mode, const std::string& work_dir);
+
+// дополнение набора: кратчайшие последовательности из начального состояния, закрывающие непокрытые состояния
+// (или переходы): один обход в ширину дает кратчайший префикс каждого пробела, пробелы берутся от самых глубоких, покрытые
+// уже выданными последовательностями пропускаются. Последовательности - номера переходов (ячеек таблицы); недостижимые
+// из начального состояния пробелы пропускаются
+std::vector<std::vector<std::size_t>> top_up_sequences(const CompiledMachine& machine, const Coverage& coverage, bool cover_transitions);
+// запись в формате sequence_formation --with-outputs
+void write_sequences(const std::string& path, const CompiledMachine& machine, const std::vector<std::vector<std::size_t>>& sequences);
+
+// композиция автоматов Мили:
+// serial - выход компонента подается на вход следующего, выход композиции - выход последнего;
+// parallel - вход двигает все компоненты, у которых он есть (остальные стоят), выходы двигавшихся соединяются через '|';
+// product - синхронное произведение по общим для всех компонентов входам, выходы соединяются через '|'
+enum class Composition {
+    serial,
+    parallel,
+    product
+};
+
+Composition parse_composition(const std::string& name);
+
+// кортежи состояний компонентов в блоках фиксированного размера: адреса не меняются при росте
+class StateArena {
+  public:
+    explicit StateArena(std::size_t width);
+
+    std::uint32_t* allocate();
+
+  private:
+    static constexpr std::size_t block_tuples = 4096;
+
+    std::size_t width;
+    std::vector<std::unique_ptr<std::uint32_t[]>> blocks;
+    std::size_t used = block_tuples;
+};
+
+// композиция, строящаяся по запросу: состояние композиции - кортеж состояний компонентов, получающий номер при первом
+// достижении (хеш-таблица кортежей), переходы вычисляются при первом обращении и запоминаются в плоской таблице,
+// поэтому в памяти только достижимая часть, сколь бы велико ни было полное произведение
+class ComposedMachine {
+  public:
+    ComposedMachine(std::vector<CompiledMachine> components, Composition kind);
+
+    ComposedMachine(const ComposedMachine&) = delete;
+    ComposedMachine& operator=(const ComposedMachine&) = delete;
+
+    std::uint32_t initial_state() const { return 0; }
+    std::uint32_t n_inputs() const { return static_cast<std::uint32_t>(input_names.size()); }
+    std::uint32_t n_states() const { return static_cast<std::uint32_t>(tuples.size()); }
+    const std::vector<std::string>& inputs() const { return input_names; }
+    const std::string& output_name(std::uint32_t output) const { return output_names[output]; }
+    const std::vector<std::string>& outputs() const { return output_names; }
+    std::string state_name(std::uint32_t state) const;
+
+    TableEntry step(std::uint32_t state, std::uint32_t input);
+
+    // обход в ширину достижимой части и перенос ее в обычный скомпилированный автомат
+    CompiledMachine compile(std::size_t max_states);
+
+  private:
+    static constexpr std::uint32_t not_computed = no_transition - 1;
+
+    std::uint32_t intern_state(const std::uint32_t* tuple);
+    std::uint32_t intern_output(const std::string& output);
+    std::uint64_t tuple_hash(const std::uint32_t* tuple) const;
+    void grow_slots();
+
+    std::vector<CompiledMachine> components;
+    Composition kind;
+
+    std::vector<std::string> input_names;
+    std::vector<std::vector<std::uint32_t>> component_inputs; // [компонент][вход композиции] -> вход компонента или no_transition
+    std::vector<std::vector<std::uint32_t>> links;            // serial: [компонент][его выход] -> вход следующего или no_transition
+    std::vector<std::string> output_names;
+    std::unordered_map<std::string, std::uint32_t> output_ids;
+
+    StateArena arena;
+    std::vector<const std::uint32_t*> tuples;
+    std::vector<std::uint32_t> slots; // открытая адресация по номерам состояний, no_transition - пусто
+    std::vector<TableEntry> table;
+    std::vector<std::uint32_t> scratch;
+};
+
+// проверка соответствия композиции без ее компиляции: переходы вычисляются по ходу проигрывания, в памяти - только
+// пройденные кортежи; step дополняет таблицу композиции, поэтому проверка однопоточная
+ConformanceReport check_conformance(ComposedMachine& machine, const std::string& sequences_file, bool trace);
+
+// потоковая запись достижимой части композиции в хранилище во внешней памяти: строки состояний пишутся по мере
+// обхода в ширину, без промежуточного скомпилированного автомата; результат - число достижимых состояний
+std::uint32_t composition_to_store(ComposedMachine& machine, const std::string& directory, std::uint32_t shard_states, std::size_t max_states);
+
+// LRU-кеш скомпилированных автоматов для режима --serve: ключ - путь к JSON, запись устаревает при изменении mtime файла
+class MachineCache {
+  public:
+    explicit MachineCache(std::size_t capacity);
+
+    std::shared_ptr<const CompiledMachine> get(const std::string& path);
+
+  private:
+    struct Entry {
+        std::string path;
+        std::int64_t mtime;
+        std::shared_ptr<const CompiledMachine> machine;
+    };
+
+    std::size_t capacity;
+    std::list<Entry> entries; // от недавно использованных к давно использованным
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::mutex mutex;
 };
-std::unordered_set<Path, PathHash> get_all_paths(const pt::ptree& machine, int path_len);
 
-bool is_valid_path(const pt::ptree& machine, const std::vector<std::string>& path, const std::string& initial_state);
-int find_max_path_len(const pt::ptree& transitions, const std::string& current_state, std::unordered_map<std::string, int>& memo, int input_length, std::unordered_set<std::string>& visited);
-bool verify_etalon_in_sequences(const std::vector<std::vector<std::string>>& etalon, const std::vector<std::vector<std::string>>& sequences);
-std::vector<Transition> find_transitions_from_state(const pt::ptree& machine, const std::string& state);
+// пул потоков с общей очередью задач; wait() дожидается выполнения всех поставленных задач
+class ThreadPool {
+  public:
+    explicit ThreadPool(unsigned int workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+
+  private:
+    void work();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::size_t running = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef TRANSITION_STORE_HPP
+#define TRANSITION_STORE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+// автомат во внешней памяти: таблица переходов разбита на шарды по диапазонам номеров состояний
+// (shard_<k>.bin - строки состояний [k * shard_states, (k + 1) * shard_states) по n_inputs записей TableEntry),
+// имена состояний - states.txt с индексом смещений states.idx, входы и выходы - inputs.txt/outputs.txt, параметры - meta.txt
+
+constexpr std::uint32_t no_transition = std::numeric_limits<std::uint32_t>::max();
+
+struct TableEntry {
+    std::uint32_t next_state;
+    std::uint32_t output;
+};
+
+// личный временный каталог (mkdtemp в parent): имена файлов внутри не пересекаются с параллельными проверками,
+// при разрушении каталог удаляется вместе с содержимым
+class TemporaryDirectory {
+  public:
+    explicit TemporaryDirectory(const std::string& parent);
+    ~TemporaryDirectory();
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    std::string path(const std::string& name) const { return directory + "/" + name; }
+
+  private:
+    std::string directory;
+};
+
+// новый файл фиксированного размера, отображенный в память для чтения и записи (заполнен нулями);
+// существующий файл не открывается, чтобы не обрезать чужое отображение
+class MappedArrayFile {
+  public:
+    MappedArrayFile(const std::string& path, std::size_t bytes);
+    ~MappedArrayFile();
+
+    MappedArrayFile(const MappedArrayFile&) = delete;
+    MappedArrayFile& operator=(const MappedArrayFile&) = delete;
+
+    void* data() const { return region; }
+
+  private:
+    void* region = nullptr;
+    std::size_t length;
+};
+
+// битовая карта на диске: страницы подгружаются и сбрасываются системой, в памяти держится только рабочая часть
+class DiskBitset {
+  public:
+    DiskBitset(const std::string& path, std::uint64_t size);
+
+    void set(std::uint64_t index) { words[index >> 6] |= std::uint64_t{1} << (index & 63); }
+    bool test(std::uint64_t index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+    std::uint64_t size() const { return bits; }
+
+  private:
+    MappedArrayFile file;
+    std::uint64_t* words;
+    std::uint64_t bits;
+};
+
+class TransitionStore {
+  public:
+    explicit TransitionStore(const std::string& directory);
+    ~TransitionStore();
+
+    TransitionStore(const TransitionStore&) = delete;
+    TransitionStore& operator=(const TransitionStore&) = delete;
+
+    std::uint32_t n_states() const { return states; }
+    std::uint32_t n_inputs() const { return inputs; }
+    std::uint32_t initial_state() const { return initial; }
+    std::uint32_t shard_states() const { return per_shard; }
+    std::uint32_t n_shards() const { return (states + per_shard - 1) / per_shard; }
+    std::uint32_t shard_of(std::uint32_t state) const { return state / per_shard; }
+
+    const std::vector<std::string>& input_names() const { return input_list; }
+    const std::vector<std::string>& output_names() const { return output_list; }
+    std::string state_name(std::uint32_t state) const;
+
+    // произвольный доступ (проигрывание последовательностей): шард отображается в память при первом обращении
+    const TableEntry& step(std::uint32_t state, std::uint32_t input) const;
+
+    // последовательное чтение шарда целиком в buffer; prefetch_shard просит систему заранее подгрузить шард
+    void load_shard(std::uint32_t shard, std::vector<TableEntry>& buffer) const;
+    void prefetch_shard(std::uint32_t shard) const;
+
+    std::string shard_path(std::uint32_t shard) const;
+
+  private:
+    std::string directory;
+    std::uint32_t states = 0;
+    std::uint32_t inputs = 0;
+    std::uint32_t initial = 0;
+    std::uint32_t per_shard = 1;
+    std::vector<std::string> input_list;
+    std::vector<std::string> output_list;
+
+    const char* names = nullptr;
+    std::size_t names_length = 0;
+    const std::uint64_t* name_offsets = nullptr;
+    std::size_t offsets_length = 0;
+    mutable std::vector<const TableEntry*> mapped_shards;
+};
+
+// запись хранилища: состояния добавляются по порядку номеров, шарды пишутся последовательно
+class TransitionStoreWriter {
+  public:
+    TransitionStoreWriter(const std::string& directory, std::uint32_t shard_states, const std::vector<std::string>& input_names, const std::vector<std::string>& output_names);
+    ~TransitionStoreWriter();
+
+    TransitionStoreWriter(const TransitionStoreWriter&) = delete;
+    TransitionStoreWriter& operator=(const TransitionStoreWriter&) = delete;
+
+    // выходы, ставшие известными только по ходу записи (композиция): outputs.txt переписывается
+    void set_output_names(const std::vector<std::string>& output_names);
+    void add_state(const std::string& name, const TableEntry* row);
+    void finish(std::uint32_t initial_state);
+
+  private:
+    void write_symbols(const std::string& file_name, const std::vector<std::string>& symbols);
+
+    std::string directory;
+    std::uint32_t per_shard;
+    std::uint32_t inputs;
+    std::uint32_t states = 0;
+    std::uint64_t names_offset = 0;
+    std::FILE* shard = nullptr;
+    std::FILE* names = nullptr;
+    std::FILE* offsets = nullptr;
+};
+
+// обход в ширину во внешней памяти: кандидаты следующего уровня раскладываются по файлам-корзинам шардов их состояний,
+// затем шарды с непустыми корзинами читаются по порядку целиком (с упреждающей подгрузкой следующего);
+// посещенные состояния и корзины - во временном каталоге внутри work_dir. on_discover(state, parent, input) вызывается для каждого достигнутого
+// состояния (для начального parent и input - no_transition); результат - число достижимых состояний
+std::uint64_t external_bfs(const TransitionStore& store, const std::string& work_dir,
+    const std::function<void(std::uint32_t, std::uint32_t, std::uint32_t)>& on_discover);
+
+#endif
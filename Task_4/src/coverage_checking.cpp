@@ -1,39 +1,18 @@
 #include "functions.hpp"
 
-auto check_coverage_states(const pt::ptree& machine, const std::vector<std::vector<std::string>>& sequences) {
+auto check_coverage_states(const CompiledMachine& machine, const Coverage& coverage) {
 
-    auto all_states = get_all_states(machine);
-
-    auto initial_state = machine.get<std::string>("initial_state");
-    std::unordered_set<std::string> visited_states;
-    visited_states.insert(initial_state); // т.к. пустые автоматы не рассматриваем
-
-    for (const auto& sequence : sequences) {
-        std::string current_state = initial_state;
-        for (const auto& input : sequence) {
-            try {
-
-                auto state_transitions = machine.get_child("transitions").get_child(current_state);
-                auto next_state = state_transitions.get<std::string>(input + ".state");
-
-                visited_states.insert(next_state);
-                current_state = next_state;
-            } catch (const pt::ptree_error& e) {
-                std::string msg = "Transition not found for state: " + current_state + " with input: " + input + "\n";
-                throw std::runtime_error(msg);
-            }
-        }
-    }
+    auto required = required_states(machine);
 
     // вывод всех непосещенных состояний, если они есть
     std::ostringstream missing_states_msg;
     auto has_missing_states = false;
-    for (const auto& state : all_states) {
-        if (visited_states.find(state) == visited_states.end()) {
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        if (required.test(state) && !coverage.states.test(state)) {
             if (has_missing_states) {
                 missing_states_msg << ", ";
             }
-            missing_states_msg << state;
+            missing_states_msg << machine.state_names[state];
             has_missing_states = true;
         }
     }
@@ -46,41 +25,17 @@ auto check_coverage_states(const pt::ptree& machine, const std::vector<std::vect
     return 0;
 }
 
-auto check_coverage_transitions(const pt::ptree& machine, const std::vector<std::vector<std::string>>& sequences) {
-
-    auto all_transitions = get_all_transitions(machine);
-
-    std::unordered_set<Transition, Transition::Hash> visited_transitions;
-    std::string initial_state = machine.get<std::string>("initial_state");
-
-    for (const auto& sequence : sequences) {
-        std::string current_state = initial_state;
-        for (const auto& input : sequence) {
-            try {
-                auto transitions = machine.get_child("transitions").get_child(current_state);
-                std::string next_state = transitions.get<std::string>(input + ".state");
-                std::string output = transitions.get<std::string>(input + ".output");
-                visited_transitions.insert({current_state, next_state, input, output});
-                current_state = next_state;
-            } catch (const pt::ptree_error& e) {
-                std::string msg = "Error processing transition from state " + current_state + " with input: " + input + "\n";
-                throw std::runtime_error(msg);
-            }
-        }
-    }
+auto check_coverage_transitions(const CompiledMachine& machine, const Coverage& coverage) {
 
     // вывод всех непосещенных переходов, если они есть
     std::ostringstream missing_transitions_msg;
     auto has_missing_transitions = false;
-    for (const auto& transition : all_transitions) {
-        if (visited_transitions.find(transition) == visited_transitions.end()) {
+    for (size_t transition = 0; transition < machine.table.size(); ++transition) {
+        if (machine.table[transition].next_state != no_transition && !coverage.transitions.test(transition)) {
             if (has_missing_transitions) {
                 missing_transitions_msg << "\n";
             }
-            missing_transitions_msg << "[" << transition.current_state << " -> "
-                                    << transition.next_state << " (input: "
-                                    << transition.input_symbol << ", output: "
-                                    << transition.output_symbol << ")]";
+            missing_transitions_msg << transition_to_string(machine, transition);
             has_missing_transitions = true;
         }
     }
@@ -93,112 +48,276 @@ auto check_coverage_transitions(const pt::ptree& machine, const std::vector<std:
     return 0;
 }
 
-auto check_coverage_paths(const pt::ptree& machine, const std::vector<std::vector<std::string>>& sequences, int path_len) {
-    auto initial_state = machine.get<std::string>("initial_state");
-    auto transitions = machine.get_child("transitions");
+// пути проверяются за тот же проход: число различных путей, отмеченных скользящим окном, сравнивается с числом, посчитанным динамикой
+auto check_coverage_paths(const CompiledMachine& machine, const Coverage& coverage) {
+    auto total_paths = count_paths(machine, coverage.path_len());
+    if (coverage.paths.size() < total_paths) {
+        std::string msg = "Some etalon elements are missing in sequences: covered " + std::to_string(coverage.paths.size()) + " of " + std::to_string(total_paths) + " paths of length " + std::to_string(coverage.path_len()) + "\n";
+        throw std::runtime_error(msg);
+    }
+
+    return 0;
+}
+
+// параметры одной проверки: из командной строки или из строки запроса в режиме --serve
+struct CheckRequest {
+    std::string mode;
+    unsigned int path_len = 0;
+    std::string json_description;
+    std::string sequences_file;
+    unsigned int jobs = 1;
+    std::string coverage_out;
+    std::vector<std::string> coverage_in;
+    std::vector<std::string> merge_maps;
+    bool report = false;
+    bool trace = false;
+    std::string complete_out;
+    std::string store;
+    std::string work_dir;
+    std::string simd = "auto";
+    std::string compose;
+    std::vector<std::string> components;
+    std::size_t max_states = 10000000;
+};
+
+using MachineLoader = std::function<std::shared_ptr<const CompiledMachine>(const std::string&)>;
+
+po::options_description check_options(CheckRequest& request) {
+    po::options_description desc("Allowed options");
+    desc.add_options()("help", "produce help message")("mode", po::value<std::string>(&request.mode), "working mode (states/transitions/paths/conformance/all)")("path-len", po::value<unsigned int>(&request.path_len), "length of the path in paths and all modes")("json-description", po::value<std::string>(&request.json_description), "JSON description file path")("seq", po::value<std::string>(&request.sequences_file), "checked sequence file path")("jobs", po::value<unsigned int>(&request.jobs)->default_value(1), "number of replay threads (0 - all hardware threads)")("coverage-out", po::value<std::string>(&request.coverage_out), "write binary coverage map (state/transition hit counters) to file")("coverage-in", po::value<std::vector<std::string>>(&request.coverage_in)->composing(), "check coverage from coverage map instead of replaying --seq (can be repeated, maps are merged)")("merge", po::value<std::vector<std::string>>(&request.merge_maps)->multitoken(), "merge coverage maps into --coverage-out")("report", po::bool_switch(&request.report), "print coverage report (covered/total, items not covered)")("trace", po::bool_switch(&request.trace), "in conformance mode --seq is an implementation trace (one input/output step per line, runs separated by empty lines)")("complete", po::value<std::string>(&request.complete_out), "write shortest additional sequences closing the coverage gaps (states/transitions modes) to file")("store", po::value<std::string>(&request.store), "check a machine kept in an external-memory transition store (fsm_store) instead of JSON (states/transitions modes)")("work-dir", po::value<std::string>(&request.work_dir), "directory for disk-backed coverage bitmaps in --store mode (default: the store directory)")("simd", po::value<std::string>(&request.simd)->default_value("auto"), "replay executor (auto/scalar/avx2/avx512): several sequences are replayed at once in SIMD lanes")("compose", po::value<std::string>(&request.compose), "check the composition (serial/parallel/product) of the machines given as JSON descriptions; conformance mode explores only the visited part")("component", po::value<std::vector<std::string>>(&request.components)->composing(), "JSON description of a further component in --compose mode")("max-states", po::value<std::size_t>(&request.max_states)->default_value(10000000), "in --compose mode fail if the composition has more reachable states (all modes but conformance)");
+    return desc;
+}
 
-    // изначально нужно подсчитать валидную длину путей
-    std::unordered_map<std::string, int> memo;
-    std::unordered_set<std::string> visited;
-    auto max_path_len = find_max_path_len(transitions, initial_state, memo, path_len, visited);
-    auto real_max_path_len = std::min(max_path_len, path_len);
+// компоненты композиции загружаются тем же загрузчиком, что и одиночный автомат (в режиме --serve - из кеша)
+std::unique_ptr<ComposedMachine> compose_machines(const CheckRequest& request, const MachineLoader& load_machine) {
+    std::vector<CompiledMachine> components;
+    components.push_back(*load_machine(request.json_description));
+    for (const auto& component : request.components) {
+        components.push_back(*load_machine(component));
+    }
+    return std::make_unique<ComposedMachine>(std::move(components), parse_composition(request.compose));
+}
 
-    // контейнеры хранения путей
-    std::vector<std::vector<std::string>> etalon;
-    std::vector<std::list<Transition>> tmp_paths;
-    std::vector<std::list<Transition>> result_paths;
-    std::unordered_set<std::list<Transition>, Transition::ListHash> incomplete_and_deadending_paths;
+// выполнение одной проверки; непройденная проверка - исключение, как и раньше
+void run_request(const CheckRequest& request, const MachineLoader& load_machine, std::ostream& out) {
 
-    // начальное состояние есть всегда, поэтому его можно добавить
-    auto initial_trs = find_transitions_from_state(machine, initial_state);
-    if (real_max_path_len != 1) {
-        for (auto& trs : initial_trs) {
-            tmp_paths.push_back({trs});
+    // объединение карт покрытия не требует ни автомата, ни проигрывания
+    if (!request.merge_maps.empty()) {
+        if (request.coverage_out.empty()) {
+            throw std::invalid_argument("--merge requires --coverage-out");
         }
-    } else {
-        if (initial_trs.empty()) {
-            auto msg = "No transitions available for state " + initial_state + "\n";
-            throw std::runtime_error(msg);
+        auto merged = read_coverage_map(request.merge_maps.front());
+        for (size_t i = 1; i < request.merge_maps.size(); ++i) {
+            merge_coverage_maps(merged, read_coverage_map(request.merge_maps[i]));
         }
-        for (auto& trs : initial_trs) {
-            result_paths.push_back({trs});
+        write_coverage_map(request.coverage_out, merged);
+        return;
+    }
+
+    const auto& mode = request.mode;
+
+    // автомат во внешней памяти проверяется отдельно: таблица не загружается целиком
+    if (!request.store.empty()) {
+        if (mode != "states" && mode != "transitions") {
+            throw std::invalid_argument("--store supports only states and transitions modes");
         }
-        for (const auto& transition_list : result_paths) {
-            std::vector<std::string> string_vector;
-            for (const auto& transition : transition_list) {
-                std::stringstream ss;
-                ss << transition.input_symbol;
-                string_vector.push_back(ss.str());
-            }
-            etalon.push_back(string_vector);
-        }
-        return 0;
-    }
-
-    // теперь добавляем переходы (если они есть)
-    for (size_t i = 1; i < real_max_path_len; i++) {
-        std::vector<std::list<Transition>> new_paths;
-
-        for (auto& path : tmp_paths) {
-            auto it_f = incomplete_and_deadending_paths.find(path);
-            if (it_f == incomplete_and_deadending_paths.end()) {
-                auto ending = path.back().next_state;
-                auto ending_trs = find_transitions_from_state(machine, ending);
-                if (!ending_trs.empty() && i < real_max_path_len - 1) {
-                    for (auto& end : ending_trs) {
-                        auto new_path = path;
-                        new_path.push_back(end);
-                        new_paths.push_back(new_path);
-                    }
-                } else {
-                    if (ending_trs.empty()) {
-                        result_paths.push_back(path);
-                    } else {
-                        for (auto& end : ending_trs) {
-                            auto new_path = path;
-                            new_path.push_back(end);
-                            result_paths.push_back(new_path);
-                        }
-                    }
-                }
-            }
-            incomplete_and_deadending_paths.insert(path);
+        if (request.sequences_file.empty()) {
+            throw std::invalid_argument("--store requires --seq");
+        }
+        if (!request.compose.empty()) {
+            throw std::invalid_argument("--store cannot be combined with --compose");
         }
-        tmp_paths.insert(tmp_paths.end(), new_paths.begin(), new_paths.end());
+        TransitionStore store(request.store);
+        check_store_coverage(store, request.sequences_file, mode, request.work_dir.empty() ? request.store : request.work_dir);
+        return;
+    }
+
+    if (request.json_description.empty()) {
+        throw std::invalid_argument("JSON description file must be specified");
+    }
+    if (!request.components.empty() && request.compose.empty()) {
+        throw std::invalid_argument("Several JSON descriptions can be given only with --compose");
+    }
+    if (mode.empty() && !request.report && request.coverage_out.empty()) {
+        throw std::invalid_argument("Working mode must be specified");
+    }
+    if (mode != "" && mode != "states" && mode != "transitions" && mode != "paths" && mode != "conformance" && mode != "all") {
+        throw std::invalid_argument("Invalid mode: " + mode + ". There're only 5 modes: states/transitions/paths/conformance/all");
     }
 
-    // для сверки
-    for (const auto& transition_list : result_paths) {
-        std::vector<std::string> string_vector;
-        for (const auto& transition : transition_list) {
-            std::stringstream ss;
-            ss << transition.input_symbol;
-            string_vector.push_back(ss.str());
+    // соответствие проверяется только по выходам, покрытие при этом не собирается
+    if (mode == "conformance") {
+        if (request.sequences_file.empty()) {
+            throw std::invalid_argument("Conformance mode requires --seq");
+        }
+        // композиция не компилируется: строятся только кортежи, через которые проходят последовательности
+        ConformanceReport report;
+        if (!request.compose.empty()) {
+            report = check_conformance(*compose_machines(request, load_machine), request.sequences_file, request.trace);
+        } else {
+            auto compiled_machine = load_machine(request.json_description);
+            report = check_conformance(*compiled_machine, request.sequences_file, request.jobs, request.trace, parse_simd_level(request.simd));
         }
-        etalon.push_back(string_vector);
+        for (const auto& divergence : report.divergences) {
+            out << divergence_message(divergence) << "\n";
+        }
+        if (!report.divergences.empty()) {
+            throw std::runtime_error("Outputs diverge from the machine in " + std::to_string(report.divergences.size()) + " of " + std::to_string(report.sequences) + " sequences\n");
+        }
+        return;
     }
 
-    auto result = verify_etalon_in_sequences(etalon, sequences);
-    if (!result) {
-        throw std::runtime_error("Some etalon elements are missing in sequences.\n");
+    if (mode == "paths" || mode == "all") {
+
+        if (request.path_len <= 0) {
+
+            throw std::invalid_argument("Path length must be positive in " + mode + " mode");
+        }
+        if (request.sequences_file.empty()) {
+            throw std::invalid_argument("Paths coverage requires --seq (coverage maps do not hold paths)");
+        }
     }
 
-    return 0;
+    // покрытие требует всей достижимой части, поэтому композиция компилируется целиком
+    auto compiled_machine_ptr = request.compose.empty() ? load_machine(request.json_description) :
+        std::make_shared<const CompiledMachine>(compose_machines(request, load_machine)->compile(request.max_states));
+    const auto& compiled_machine = *compiled_machine_ptr;
+
+    // покрытие: из карт (итог по многим шардам/запускам) или проигрыванием файла последовательностей
+    Coverage coverage(compiled_machine);
+    if (!request.coverage_in.empty()) {
+        auto merged = read_coverage_map(request.coverage_in.front());
+        for (size_t i = 1; i < request.coverage_in.size(); ++i) {
+            merge_coverage_maps(merged, read_coverage_map(request.coverage_in[i]));
+        }
+        coverage = map_to_coverage(compiled_machine, merged);
+    } else if (!request.sequences_file.empty()) {
+        ReplayOptions options;
+        options.jobs = request.jobs;
+        options.simd = parse_simd_level(request.simd);
+        options.count_hits = !request.coverage_out.empty();
+        options.path_len = (mode == "paths" || mode == "all") ? request.path_len : 0;
+        coverage = replay_file(compiled_machine, request.sequences_file, options);
+    } else {
+        throw std::invalid_argument("Either --seq or --coverage-in must be specified");
+    }
+
+    if (!request.coverage_out.empty()) {
+        write_coverage_map(request.coverage_out, coverage_to_map(compiled_machine, coverage));
+    }
+    if (request.report || mode == "all") {
+        print_coverage_report(out, compiled_machine, coverage);
+    }
+
+    // дополнение пишется до проверки, которая при пробелах завершится ошибкой
+    if (!request.complete_out.empty()) {
+        if (mode != "states" && mode != "transitions" && mode != "all") {
+            throw std::invalid_argument("--complete is supported only in states, transitions and all modes");
+        }
+        write_sequences(request.complete_out, compiled_machine, top_up_sequences(compiled_machine, coverage, mode != "states"));
+    }
+
+    if (mode == "states") {
+
+        check_coverage_states(compiled_machine, coverage);
+
+    } else if (mode == "transitions") {
+
+        check_coverage_transitions(compiled_machine, coverage);
+
+    } else if (mode == "paths") {
+
+        check_coverage_paths(compiled_machine, coverage);
+
+    } else if (mode == "all") {
+
+        // все критерии по одному проигрыванию; об ошибках сообщается вместе
+        std::string msg;
+        for (auto check : {check_coverage_states, check_coverage_transitions, check_coverage_paths}) {
+            try {
+                check(compiled_machine, coverage);
+            } catch (const std::runtime_error& e) {
+                msg += e.what();
+            }
+        }
+        if (!msg.empty()) {
+            throw std::runtime_error(msg);
+        }
+    }
+}
+
+// ответ на запрос: "<номер запроса> ok|error <число строк>", затем сами строки (вывод проверки или текст ошибки)
+void write_response(std::ostream& out, std::mutex& out_mutex, std::size_t id, bool ok, const std::string& body) {
+    std::vector<std::string> lines;
+    std::istringstream body_stream(body);
+    for (std::string line; std::getline(body_stream, line);) {
+        lines.push_back(line);
+    }
+
+    std::ostringstream response;
+    response << id << (ok ? " ok " : " error ") << lines.size() << "\n";
+    for (const auto& line : lines) {
+        response << line << "\n";
+    }
+
+    std::lock_guard<std::mutex> lock(out_mutex);
+    out << response.str() << std::flush;
+}
+
+// режим демона: строка stdin - аргументы одной проверки (как в командной строке), проверки выполняются пулом потоков,
+// скомпилированные автоматы переиспользуются между запросами; конец ввода или "quit" - завершение после всех ответов
+void serve(std::istream& in, std::ostream& out, unsigned int workers, std::size_t cache_size) {
+    MachineCache cache(cache_size);
+    MachineLoader load_machine = [&cache](const std::string& path) { return cache.get(path); };
+    std::mutex out_mutex;
+
+    ThreadPool pool(workers);
+    std::size_t id = 0;
+    for (std::string line; std::getline(in, line);) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (line == "quit") {
+            break;
+        }
+
+        pool.submit([line, request_id = ++id, &load_machine, &out, &out_mutex]() {
+            std::ostringstream body;
+            auto ok = true;
+            try {
+                CheckRequest request;
+                auto desc = check_options(request);
+                po::positional_options_description p;
+                p.add("json-description", 1);
+                p.add("component", -1);
+
+                po::variables_map vm;
+                po::store(po::command_line_parser(po::split_unix(line)).options(desc).positional(p).run(), vm);
+                po::notify(vm);
+                run_request(request, load_machine, body);
+            } catch (const std::exception& e) {
+                body << e.what();
+                ok = false;
+            }
+            write_response(out, out_mutex, request_id, ok, body.str());
+        });
+    }
+    pool.wait();
 }
 
 int main(int argc, char* argv[]) {
     try {
 
-        std::string mode;
-        unsigned int path_len;
-        std::string json_description;
-        std::string sequences_file;
+        CheckRequest request;
+        unsigned int workers = 0;
+        std::size_t cache_size = 16;
 
-        po::options_description desc("Allowed options");
-        desc.add_options()("help", "produce help message")("mode", po::value<std::string>(&mode)->required(), "working mode (states/transitions/paths)")("path-len", po::value<unsigned int>(&path_len), "length of the path in paths mode")("json-description", po::value<std::string>(&json_description)->required(), "JSON description file path")("seq", po::value<std::string>(&sequences_file)->required(), "checked sequence file path");
+        auto desc = check_options(request);
+        desc.add_options()("serve", "serve check requests from stdin, one command line per request")("workers", po::value<unsigned int>(&workers)->default_value(0), "number of worker threads in --serve mode (0 - all hardware threads)")("cache-size", po::value<std::size_t>(&cache_size)->default_value(16), "number of compiled machines kept in --serve mode");
 
         po::positional_options_description p;
         p.add("json-description", 1);
+        p.add("component", -1);
 
         po::variables_map vm;
         po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
@@ -210,29 +329,19 @@ int main(int argc, char* argv[]) {
 
         po::notify(vm);
 
-        auto readed_machine = json_to_machine(json_description);
-        auto sequences = read_sequences(sequences_file);
-
-        if (mode == "states") {
-
-            check_coverage_states(readed_machine, sequences);
-
-        } else if (mode == "transitions") {
-
-            check_coverage_transitions(readed_machine, sequences);
-
-        } else if (mode == "paths") {
-
-            if (path_len <= 0) {
-
-                throw std::invalid_argument("Path length must be positive in paths mode");
+        if (vm.count("serve")) {
+            if (workers == 0) {
+                workers = std::max(1u, std::thread::hardware_concurrency());
             }
-            check_coverage_paths(readed_machine, sequences, path_len);
-
-        } else {
-            throw std::invalid_argument("Invalid mode: " + mode + ". There're only 3 modes: states/transitions/paths");
+            serve(std::cin, std::cout, workers, cache_size);
+            return 0;
         }
 
+        MachineLoader load_machine = [](const std::string& path) {
+            return std::make_shared<const CompiledMachine>(compile_machine(json_to_machine(path)));
+        };
+        run_request(request, load_machine, std::cout);
+
     } catch (const po::error& e) {
         std::cerr << "Command line error: " << e.what() << "\n";
         return 2;
@@ -240,4 +349,4 @@ int main(int argc, char* argv[]) {
         std::cerr << "Error: " << e.what() << "\n";
         return 2;
     }
-}
\ No newline at end of file
+}
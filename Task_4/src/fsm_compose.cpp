@@ -0,0 +1,65 @@
+#include "functions.hpp"
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::string kind_name;
+        std::vector<std::string> json_descriptions;
+        std::string output_file;
+        std::string store_directory;
+        std::uint32_t shard_states = 0;
+        std::size_t max_states = 0;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("kind", po::value<std::string>(&kind_name)->default_value("product"), "composition kind (serial/parallel/product)")("json-description", po::value<std::vector<std::string>>(&json_descriptions)->required(), "JSON description files of the components, in order")("out", po::value<std::string>(&output_file), "output JSON file with the reachable part of the composition")("store", po::value<std::string>(&store_directory), "directory of a transition store (fsm_store format) with the reachable part of the composition, written as it is explored")("shard-states", po::value<std::uint32_t>(&shard_states)->default_value(65536), "number of states per shard file in --store")("max-states", po::value<std::size_t>(&max_states)->default_value(10000000), "fail if the composition has more reachable states");
+
+        po::positional_options_description p;
+        p.add("json-description", -1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        if (output_file.empty() && store_directory.empty()) {
+            throw std::invalid_argument("Either --out or --store must be specified");
+        }
+        auto kind = parse_composition(kind_name);
+
+        std::vector<CompiledMachine> components;
+        for (const auto& json_description : json_descriptions) {
+            components.push_back(compile_machine(json_to_machine(json_description)));
+        }
+
+        ComposedMachine composed(std::move(components), kind);
+
+        // хранилище пишется по ходу обхода без копии автомата; для JSON нужен скомпилированный автомат и дерево описания
+        if (!store_directory.empty()) {
+            composition_to_store(composed, store_directory, shard_states, max_states);
+        }
+        if (!output_file.empty()) {
+            auto compiled = composed.compile(max_states);
+            pt::write_json(output_file, machine_to_json(compiled));
+        }
+
+        std::size_t n_transitions = 0;
+        for (std::uint32_t state = 0; state < composed.n_states(); ++state) {
+            for (std::uint32_t input = 0; input < composed.n_inputs(); ++input) {
+                n_transitions += composed.step(state, input).next_state != no_transition;
+            }
+        }
+        std::cout << "Reachable states: " << composed.n_states() << ", transitions: " << n_transitions << "\n";
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,225 @@
+#include "functions.hpp"
+
+// система непересекающихся множеств с объединением по рангу и сжатием путей
+class UnionFind {
+  public:
+    explicit UnionFind(std::size_t size) : parent(size), rank(size, 0) {
+        for (size_t i = 0; i < size; ++i) {
+            parent[i] = static_cast<std::uint32_t>(i);
+        }
+    }
+
+    std::uint32_t find(std::uint32_t x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    bool unite(std::uint32_t a, std::uint32_t b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return false;
+        }
+        if (rank[a] < rank[b]) {
+            std::swap(a, b);
+        }
+        parent[b] = a;
+        rank[a] += rank[a] == rank[b];
+        return true;
+    }
+
+  private:
+    std::vector<std::uint32_t> parent;
+    std::vector<std::uint8_t> rank;
+};
+
+// общий входной алфавит двух автоматов (объединение по именам); вход, которого у автомата нет, - отсутствующий переход
+struct AlignedInputs {
+    std::vector<std::string> names;
+    std::vector<std::uint32_t> first;
+    std::vector<std::uint32_t> second;
+};
+
+AlignedInputs align_inputs(const CompiledMachine& a, const CompiledMachine& b) {
+    AlignedInputs inputs;
+    inputs.names = a.input_names;
+    for (const auto& name : b.input_names) {
+        if (!a.input_ids.count(name)) {
+            inputs.names.push_back(name);
+        }
+    }
+    std::sort(inputs.names.begin(), inputs.names.end());
+    for (const auto& name : inputs.names) {
+        auto it_a = a.input_ids.find(name);
+        auto it_b = b.input_ids.find(name);
+        inputs.first.push_back(it_a != a.input_ids.end() ? it_a->second : no_transition);
+        inputs.second.push_back(it_b != b.input_ids.end() ? it_b->second : no_transition);
+    }
+    return inputs;
+}
+
+TableEntry step_or_none(const CompiledMachine& machine, std::uint32_t state, std::uint32_t input) {
+    if (input == no_transition) {
+        return {no_transition, no_transition};
+    }
+    return machine.step(state, input);
+}
+
+// шаг различим, если переход есть только у одного автомата или выходы разные (выходы сравниваются по именам)
+bool distinguishes(const CompiledMachine& a, const TableEntry& ea, const CompiledMachine& b, const TableEntry& eb) {
+    if ((ea.next_state == no_transition) != (eb.next_state == no_transition)) {
+        return true;
+    }
+    return ea.next_state != no_transition && a.output_names[ea.output] != b.output_names[eb.output];
+}
+
+// алгоритм Хопкрофта-Карпа: состояния обоих автоматов в одном union-find (второй со сдвигом a.n_states()),
+// пары, которые должны быть эквивалентны, объединяются; противоречие на любой паре - автоматы не эквивалентны
+bool hopcroft_karp(const CompiledMachine& a, const CompiledMachine& b, const AlignedInputs& inputs) {
+    auto offset = a.n_states();
+    UnionFind sets(static_cast<std::size_t>(a.n_states()) + b.n_states());
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> stack;
+
+    sets.unite(a.initial_state, offset + b.initial_state);
+    stack.emplace_back(a.initial_state, b.initial_state);
+    while (!stack.empty()) {
+        auto [p, q] = stack.back();
+        stack.pop_back();
+        for (size_t input = 0; input < inputs.names.size(); ++input) {
+            auto ea = step_or_none(a, p, inputs.first[input]);
+            auto eb = step_or_none(b, q, inputs.second[input]);
+            if (distinguishes(a, ea, b, eb)) {
+                return false;
+            }
+            if (ea.next_state != no_transition && sets.unite(ea.next_state, offset + eb.next_state)) {
+                stack.emplace_back(ea.next_state, eb.next_state);
+            }
+        }
+    }
+    return true;
+}
+
+// кратчайшая различающая последовательность: обход в ширину по парам состояний (посещенные пары - в хеш-таблице)
+std::vector<std::uint32_t> shortest_distinguishing_sequence(const CompiledMachine& a, const CompiledMachine& b, const AlignedInputs& inputs) {
+    struct Visit {
+        std::uint64_t parent;
+        std::uint32_t input;
+    };
+    auto key = [&](std::uint32_t p, std::uint32_t q) { return static_cast<std::uint64_t>(p) * b.n_states() + q; };
+
+    std::unordered_map<std::uint64_t, Visit> visited;
+    std::deque<std::uint64_t> queue;
+    auto start = key(a.initial_state, b.initial_state);
+    visited.emplace(start, Visit{start, no_transition});
+    queue.push_back(start);
+
+    while (!queue.empty()) {
+        auto current = queue.front();
+        queue.pop_front();
+        auto p = static_cast<std::uint32_t>(current / b.n_states());
+        auto q = static_cast<std::uint32_t>(current % b.n_states());
+
+        for (std::uint32_t input = 0; input < inputs.names.size(); ++input) {
+            auto ea = step_or_none(a, p, inputs.first[input]);
+            auto eb = step_or_none(b, q, inputs.second[input]);
+            if (distinguishes(a, ea, b, eb)) {
+                std::vector<std::uint32_t> sequence = {input};
+                for (auto k = current; k != start; k = visited.at(k).parent) {
+                    sequence.push_back(visited.at(k).input);
+                }
+                std::reverse(sequence.begin(), sequence.end());
+                return sequence;
+            }
+            if (ea.next_state == no_transition) {
+                continue;
+            }
+            auto next = key(ea.next_state, eb.next_state);
+            if (visited.emplace(next, Visit{current, input}).second) {
+                queue.push_back(next);
+            }
+        }
+    }
+    return {};
+}
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::vector<std::string> json_descriptions;
+        std::string output_file;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("json-description", po::value<std::vector<std::string>>(&json_descriptions)->required(), "JSON description files of the two machines")("out", po::value<std::string>(&output_file), "write the distinguishing sequence to file (sequence_formation format)")("with-outputs", "write the distinguishing sequence as input/output pairs of the first machine");
+
+        po::positional_options_description p;
+        p.add("json-description", 2);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        if (json_descriptions.size() != 2) {
+            throw std::invalid_argument("Exactly 2 JSON description files must be specified");
+        }
+
+        auto first = compile_machine(json_to_machine(json_descriptions[0]));
+        auto second = compile_machine(json_to_machine(json_descriptions[1]));
+        auto inputs = align_inputs(first, second);
+
+        if (hopcroft_karp(first, second, inputs)) {
+            std::cout << "Machines are equivalent\n";
+            return 0;
+        }
+
+        auto sequence = shortest_distinguishing_sequence(first, second, inputs);
+
+        // последовательность в формате sequence_formation; на последнем шаге у первого автомата перехода может не быть
+        std::ostringstream line;
+        std::uint32_t state_a = first.initial_state;
+        std::uint32_t state_b = second.initial_state;
+        TableEntry last_a{}, last_b{};
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            auto input = sequence[i];
+            last_a = step_or_none(first, state_a, inputs.first[input]);
+            last_b = step_or_none(second, state_b, inputs.second[input]);
+            line << (i > 0 ? "," : "") << inputs.names[input];
+            if (vm.count("with-outputs") && last_a.next_state != no_transition) {
+                line << io_separator << first.output_names[last_a.output];
+            }
+            state_a = last_a.next_state;
+            state_b = last_b.next_state;
+        }
+
+        if (!output_file.empty()) {
+            std::ofstream out(output_file);
+            if (!out.is_open()) {
+                throw std::runtime_error("Failed to open file: " + output_file);
+            }
+            out << line.str() << "\n";
+        }
+        std::cout << line.str() << "\n";
+
+        auto describe = [](const CompiledMachine& machine, const TableEntry& entry) {
+            return entry.next_state == no_transition ? std::string("no transition") : "output " + machine.output_names[entry.output];
+        };
+        // различие - результат проверки, а не ошибка: отдельный код возврата (2 - ошибки запуска и разбора)
+        std::cerr << "Machines are not equivalent: on the last input the first machine gives " << describe(first, last_a) << ", the second gives " << describe(second, last_b) << "\n";
+        return 1;
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,47 @@
+#include "functions.hpp"
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::string json_description;
+        std::string store_directory;
+        std::string reach_directory;
+        std::string work_dir;
+        std::uint32_t shard_states = 0;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("json-description", po::value<std::string>(&json_description), "JSON description file to convert (read in a streaming way; only the state name index is kept in memory)")("out", po::value<std::string>(&store_directory), "directory of the created transition store")("shard-states", po::value<std::uint32_t>(&shard_states)->default_value(65536), "number of states per shard file")("reach", po::value<std::string>(&reach_directory), "count states reachable from the initial state in a transition store (external-memory BFS)")("work-dir", po::value<std::string>(&work_dir), "directory for BFS temporary files (default: the store directory)");
+
+        po::positional_options_description p;
+        p.add("json-description", 1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        if (!reach_directory.empty()) {
+            TransitionStore store(reach_directory);
+            auto reached = external_bfs(store, work_dir.empty() ? reach_directory : work_dir, [](std::uint32_t, std::uint32_t, std::uint32_t) {});
+            std::cout << "Reachable states: " << reached << " of " << store.n_states() << "\n";
+            return 0;
+        }
+
+        if (json_description.empty() || store_directory.empty()) {
+            throw std::invalid_argument("Either --reach or JSON description with --out must be specified");
+        }
+        json_to_store(json_description, store_directory, shard_states);
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -1,5 +1,12 @@
 #include "functions.hpp"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <iomanip>
+
 pt::ptree json_to_machine(const std::string& json_path) {
 
     pt::ptree machine;
@@ -7,152 +14,2098 @@ pt::ptree json_to_machine(const std::string& json_path) {
     return machine;
 }
 
-std::vector<std::vector<std::string>> read_sequences(const std::string& sequences_file) {
-    std::ifstream infile(sequences_file);
-    std::vector<std::vector<std::string>> sequences;
-    std::string line;
+namespace {
 
-    if (!infile.is_open()) {
-        throw std::runtime_error("Failed to open file: " + sequences_file);
+std::uint32_t intern_name(const std::string& name, std::vector<std::string>& names, std::unordered_map<std::string, std::uint32_t>& ids) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
     }
+    auto id = static_cast<std::uint32_t>(names.size());
+    names.push_back(name);
+    ids.emplace(name, id);
+    return id;
+}
 
-    while (std::getline(infile, line)) {
-        std::vector<std::string> sequence;
-        std::string item;
-        std::istringstream iss(line);
+} // namespace
+
+CompiledMachine compile_machine(const pt::ptree& machine) {
+    CompiledMachine compiled;
+    const auto& transitions = machine.get_child("transitions");
 
-        while (std::getline(iss, item, ',')) {
-            sequence.push_back(item);
+    // нумерация: сначала состояния-источники, затем встреченные только как цели переходов
+    for (const auto& state_pair : transitions) {
+        intern_name(state_pair.first, compiled.state_names, compiled.state_ids);
+    }
+    for (const auto& state_pair : transitions) {
+        for (const auto& symbol_pair : state_pair.second) {
+            intern_name(symbol_pair.second.get<std::string>("state"), compiled.state_names, compiled.state_ids);
+            intern_name(symbol_pair.first, compiled.input_names, compiled.input_ids);
+            intern_name(symbol_pair.second.get<std::string>("output"), compiled.output_names, compiled.output_ids);
         }
+    }
+
+    auto initial_state = machine.get<std::string>("initial_state");
+    compiled.initial_state = intern_name(initial_state, compiled.state_names, compiled.state_ids);
+    compiled.n_inputs = static_cast<std::uint32_t>(compiled.input_names.size());
+    compiled.table.assign(static_cast<std::size_t>(compiled.n_states()) * compiled.n_inputs, {no_transition, no_transition});
 
-        if (!sequence.empty()) {
-            sequences.push_back(sequence);
+    for (const auto& state_pair : transitions) {
+        auto state = compiled.state_ids.at(state_pair.first);
+        for (const auto& symbol_pair : state_pair.second) {
+            auto& entry = compiled.table[compiled.transition_id(state, compiled.input_ids.at(symbol_pair.first))];
+            // как и get_child, при повторяющихся ключах используется первый переход
+            if (entry.next_state != no_transition) {
+                continue;
+            }
+            entry.next_state = compiled.state_ids.at(symbol_pair.second.get<std::string>("state"));
+            entry.output = compiled.output_ids.at(symbol_pair.second.get<std::string>("output"));
+            compiled.n_transitions++;
         }
     }
 
-    return sequences;
+    return compiled;
 }
 
-std::unordered_set<std::string> get_all_states(const pt::ptree& machine) {
-    std::unordered_set<std::string> all_states;
+pt::ptree machine_to_json(const CompiledMachine& machine) {
+    pt::ptree transitions;
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        pt::ptree state_transitions;
+        for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+            const auto& entry = machine.step(state, input);
+            if (entry.next_state == no_transition) {
+                continue;
+            }
+            pt::ptree transition;
+            transition.put("state", machine.state_names[entry.next_state]);
+            transition.put("output", machine.output_names[entry.output]);
+            state_transitions.add_child(pt::ptree::path_type(machine.input_names[input], '\0'), transition);
+        }
+        transitions.add_child(pt::ptree::path_type(machine.state_names[state], '\0'), state_transitions);
+    }
 
-    const auto& transitions = machine.get_child("transitions");
-    for (const auto& item : transitions) {
-        const auto& state_transitions = item.second;
+    pt::ptree tree;
+    tree.put("initial_state", machine.state_names[machine.initial_state]);
+    tree.add_child("transitions", transitions);
+    return tree;
+}
+
+std::string transition_to_string(const CompiledMachine& machine, std::size_t transition) {
+    const auto& entry = machine.table[transition];
+    std::ostringstream oss;
+    oss << "[" << machine.state_names[transition / machine.n_inputs] << " -> "
+        << machine.state_names[entry.next_state] << " (input: "
+        << machine.input_names[transition % machine.n_inputs] << ", output: "
+        << machine.output_names[entry.output] << ")]";
+    return oss.str();
+}
+
+Bitset::Bitset(std::size_t size)
+    : words((size + 63) / 64, 0), bits(size) {}
+
+std::size_t Bitset::count() const {
+    std::size_t result = 0;
+    for (auto word : words) {
+        result += __builtin_popcountll(word);
+    }
+    return result;
+}
+
+void Bitset::merge(const Bitset& other) {
+    for (size_t i = 0; i < words.size(); ++i) {
+        words[i] |= other.words[i];
+    }
+}
+
+PathWindow::PathWindow(const CompiledMachine& machine, std::uint32_t path_len)
+    : path_len(path_len), dead_ends(dead_end_states(machine)), sources(path_len), transitions(path_len) {
+    for (std::uint32_t i = 0; i < path_len; ++i) {
+        power *= base;
+    }
+}
+
+Coverage::Coverage(const CompiledMachine& machine, bool count_hits, std::uint32_t path_len)
+    : states(machine.n_states()), transitions(machine.table.size()) {
+    if (count_hits) {
+        state_hits.assign(machine.n_states(), 0);
+        transition_hits.assign(machine.table.size(), 0);
+    }
+    if (path_len > 0) {
+        window = PathWindow(machine, path_len);
+    }
+}
 
-        for (const auto& transition : state_transitions) {
-            const auto& transition_data = transition.second;
-            auto state_opt = transition_data.get_optional<std::string>("state");
-            if (state_opt) {
-                all_states.insert(state_opt.value());
+void Coverage::merge(const Coverage& other) {
+    states.merge(other.states);
+    transitions.merge(other.transitions);
+    sequences += other.sequences;
+    for (size_t i = 0; i < state_hits.size() && i < other.state_hits.size(); ++i) {
+        state_hits[i] += other.state_hits[i];
+    }
+    for (size_t i = 0; i < transition_hits.size() && i < other.transition_hits.size(); ++i) {
+        transition_hits[i] += other.transition_hits[i];
+    }
+    paths.merge(other.paths);
+}
+
+MappedFile::MappedFile(const std::string& path)
+    : data(nullptr), length(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat file: " + path);
+    }
+
+    if (!S_ISREG(file_stat.st_mode)) {
+        char chunk[1 << 16];
+        for (;;) {
+            auto n = read(fd, chunk, sizeof(chunk));
+            if (n < 0) {
+                close(fd);
+                throw std::runtime_error("Failed to read file: " + path);
             }
+            if (n == 0) {
+                break;
+            }
+            buffer.append(chunk, static_cast<std::size_t>(n));
         }
+        close(fd);
+        data = buffer.data();
+        length = buffer.size();
+        return;
     }
 
-    return all_states;
+    length = static_cast<std::size_t>(file_stat.st_size);
+    if (length > 0) {
+        auto region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (region == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        madvise(region, length, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(region);
+        mapped = true;
+    }
+    close(fd);
 }
 
-std::unordered_set<Transition> get_all_transitions(const pt::ptree& machine) {
-    std::unordered_set<Transition> transitions;
+MappedFile::~MappedFile() {
+    if (mapped) {
+        munmap(const_cast<char*>(data), length);
+    }
+}
 
-    for (const auto& state_pair : machine.get_child("transitions")) {
-        for (const auto& symbol_pair : state_pair.second) {
-            Transition transition;
-            transition.current_state = state_pair.first;
-            transition.next_state = symbol_pair.second.get<std::string>("state");
-            transition.input_symbol = symbol_pair.first;
-            transition.output_symbol = symbol_pair.second.get<std::string>("output");
-            transitions.insert(transition);
+SymbolInterner::SymbolInterner(const std::vector<std::string>& known_symbols) {
+    for (const auto& symbol : known_symbols) {
+        intern(symbol);
+    }
+}
+
+std::uint32_t SymbolInterner::intern(std::string_view symbol) {
+    auto it = ids.find(symbol);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    auto id = static_cast<std::uint32_t>(names.size());
+    names.emplace_back(symbol);
+    ids.emplace(names.back(), id);
+    return id;
+}
+
+SequenceReader::SequenceReader(const CompiledMachine& machine, const char* begin, const char* end, std::size_t first_line)
+    : current(begin), last(end), line(first_line), input_symbols(machine.input_names), output_symbols(machine.output_names) {}
+
+bool SequenceReader::next(ParsedSequence& sequence) {
+    while (current < last) {
+        auto newline = static_cast<const char*>(std::memchr(current, '\n', last - current));
+        auto line_end = newline ? newline : last;
+        auto item = current;
+        current = newline ? newline + 1 : last;
+        sequence.line = line++;
+
+        if (line_end > item && line_end[-1] == '\r') {
+            --line_end;
+        }
+        if (item == line_end) {
+            continue;
+        }
+
+        sequence.inputs.clear();
+        sequence.outputs.clear();
+        sequence.has_outputs = false;
+        parse_items(item, line_end, sequence);
+        return true;
+    }
+    return false;
+}
+
+bool SequenceReader::next_trace(ParsedSequence& sequence) {
+    sequence.inputs.clear();
+    sequence.outputs.clear();
+    sequence.has_outputs = false;
+
+    while (current < last) {
+        auto newline = static_cast<const char*>(std::memchr(current, '\n', last - current));
+        auto line_end = newline ? newline : last;
+        auto item = current;
+
+        if (line_end > item && line_end[-1] == '\r') {
+            --line_end;
+        }
+        if (item == line_end) {
+            // пустая строка завершает прогон (ведущие пустые строки пропускаются)
+            current = newline ? newline + 1 : last;
+            line++;
+            if (!sequence.inputs.empty()) {
+                return true;
+            }
+            continue;
+        }
+
+        if (sequence.inputs.empty()) {
+            sequence.line = line;
+        }
+        current = newline ? newline + 1 : last;
+        line++;
+        parse_items(item, line_end, sequence);
+    }
+    return !sequence.inputs.empty();
+}
+
+void SequenceReader::parse_items(const char* item, const char* line_end, ParsedSequence& sequence) {
+    // как и getline: пустой элемент после завершающей запятой не считается
+    while (item < line_end) {
+        auto comma = static_cast<const char*>(std::memchr(item, ',', line_end - item));
+        auto item_end = comma ? comma : line_end;
+
+        auto separator = static_cast<const char*>(std::memchr(item, io_separator, item_end - item));
+        if (separator) {
+            sequence.inputs.push_back(input_symbols.intern(std::string_view(item, separator - item)));
+            sequence.outputs.push_back(output_symbols.intern(std::string_view(separator + 1, item_end - separator - 1)));
+            sequence.has_outputs = true;
+        } else {
+            sequence.inputs.push_back(input_symbols.intern(std::string_view(item, item_end - item)));
+            sequence.outputs.push_back(no_transition);
+        }
+
+        item = comma ? comma + 1 : line_end;
+    }
+}
+
+std::string replay_error_message(const CompiledMachine& machine, const SequenceReader& reader, const ParsedSequence& sequence, const ReplayResult& result) {
+    const auto& state = machine.state_names[result.state];
+    const auto& input = reader.inputs().name(sequence.inputs[result.position]);
+
+    if (result.status == ReplayStatus::no_transition) {
+        return "Transition not found for state: " + state + " with input: " + input + " (line " + std::to_string(sequence.line) + ")\n";
+    }
+
+    const auto& expected = reader.outputs().name(sequence.outputs[result.position]);
+    const auto& output = machine.output_names[machine.step(result.state, sequence.inputs[result.position]).output];
+    return "Output mismatch at line " + std::to_string(sequence.line) + ", position " + std::to_string(result.position + 1) +
+        " (state: " + state + ", input: " + input + "): expected " + expected + ", machine gives " + output + "\n";
+}
+
+namespace {
+
+// деление файла на jobs кусков: граница сдвигается вперед до начала следующей строки
+// (для трасс - до конца пустой строки, чтобы прогон не разрезался)
+std::vector<std::pair<const char*, const char*>> split_file(const MappedFile& file, unsigned int jobs, bool on_blank_lines) {
+    std::vector<std::pair<const char*, const char*>> pieces;
+    auto begin = file.begin();
+    for (unsigned int i = 0; i < jobs; ++i) {
+        auto end = (i + 1 == jobs) ? file.end() : std::max(begin, file.begin() + file.size() * (i + 1) / jobs);
+        while (end != file.end()) {
+            auto newline = static_cast<const char*>(std::memchr(end, '\n', file.end() - end));
+            end = newline ? newline + 1 : file.end();
+            if (!on_blank_lines || end == file.end() || *end == '\n' || (*end == '\r' && end + 1 < file.end() && end[1] == '\n')) {
+                break;
+            }
+        }
+        pieces.emplace_back(begin, end);
+        begin = end;
+    }
+    return pieces;
+}
+
+// кусок файла для одного потока проигрывания
+struct ReplayShard {
+    const char* begin;
+    const char* end;
+    SequenceReader reader;
+    Coverage coverage;
+
+    bool failed = false;
+    ParsedSequence failed_sequence;
+    ReplayResult failed_result{};
+
+    ReplayShard(const CompiledMachine& machine, const char* begin, const char* end, bool count_hits, std::uint32_t path_len)
+        : begin(begin), end(end), reader(machine, begin, end), coverage(machine, count_hits, path_len) {}
+};
+
+void fail_shard(ReplayShard& shard, std::size_t index, std::atomic<std::size_t>& first_failed, ParsedSequence sequence, const ReplayResult& result) {
+    shard.failed = true;
+    shard.failed_sequence = std::move(sequence);
+    shard.failed_result = result;
+
+    auto current = first_failed.load();
+    while (index < current && !first_failed.compare_exchange_weak(current, index)) {
+    }
+}
+
+// без окон путей последовательности проигрываются пакетами в многополосном исполнителе
+void replay_shard_lanes(const CompiledMachine& machine, ReplayShard& shard, std::size_t index, std::atomic<std::size_t>& first_failed, SimdLevel simd) {
+    ParsedSequence sequence;
+    SequenceBatch batch;
+    std::vector<ReplayResult> results;
+    auto more = true;
+    while (more) {
+        batch.clear();
+        while (!batch.full() && (more = shard.reader.next(sequence))) {
+            batch.add(sequence);
         }
+        run_lanes(machine, batch, results, &shard.coverage, simd);
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].status != ReplayStatus::ok) {
+                fail_shard(shard, index, first_failed, batch.sequence(i), results[i]);
+                return;
+            }
+        }
+        if (first_failed.load(std::memory_order_relaxed) < index) {
+            return;
+        }
+    }
+}
+
+void replay_shard(const CompiledMachine& machine, ReplayShard& shard, std::size_t index, std::atomic<std::size_t>& first_failed, SimdLevel simd) {
+    if (shard.coverage.path_len() == 0) {
+        replay_shard_lanes(machine, shard, index, first_failed, simd);
+        return;
+    }
+
+    ParsedSequence sequence;
+    while (shard.reader.next(sequence)) {
+        auto result = replay_sequence(machine, sequence, shard.coverage);
+        if (result.status != ReplayStatus::ok) {
+            fail_shard(shard, index, first_failed, sequence, result);
+            return;
+        }
+
+        // куски после уже упавшего на результат не влияют
+        if (first_failed.load(std::memory_order_relaxed) < index) {
+            return;
+        }
+    }
+}
+
+} // namespace
+
+Coverage replay_file(const CompiledMachine& machine, const std::string& sequences_file, const ReplayOptions& options) {
+    auto jobs = options.jobs;
+    auto path_len = options.path_len > 0 ? effective_path_len(machine, options.path_len) : 0;
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
     }
 
-    return transitions;
+    MappedFile file(sequences_file);
+
+    std::vector<ReplayShard> shards;
+    shards.reserve(jobs);
+    for (const auto& [begin, end] : split_file(file, jobs, false)) {
+        shards.emplace_back(machine, begin, end, options.count_hits, path_len);
+    }
+
+    std::atomic<std::size_t> first_failed{shards.size()};
+    if (shards.size() == 1) {
+        replay_shard(machine, shards[0], 0, first_failed, options.simd);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            workers.emplace_back(replay_shard, std::cref(machine), std::ref(shards[i]), i, std::ref(first_failed), options.simd);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // номер строки ошибки: строки всех предыдущих кусков + локальный номер (предыдущие куски пройдены полностью)
+    std::size_t line_offset = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        auto& shard = shards[i];
+        if (shard.failed && i == first_failed.load()) {
+            shard.failed_sequence.line += line_offset;
+            throw std::runtime_error(replay_error_message(machine, shard.reader, shard.failed_sequence, shard.failed_result));
+        }
+        line_offset += shard.reader.next_line() - 1;
+    }
+
+    Coverage coverage(machine, options.count_hits, path_len);
+    coverage.states.set(machine.initial_state); // т.к. пустые автоматы не рассматриваем
+    for (auto& shard : shards) {
+        coverage.merge(shard.coverage);
+    }
+
+    return coverage;
+}
+
+namespace {
+
+struct ConformanceShard {
+    SequenceReader reader;
+    ConformanceReport report;
+
+    ConformanceShard(const CompiledMachine& machine, const char* begin, const char* end)
+        : reader(machine, begin, end) {}
+};
+
+void check_conformance_shard(const CompiledMachine& machine, ConformanceShard& shard, bool trace, SimdLevel simd) {
+    ParsedSequence sequence;
+    SequenceBatch batch;
+    std::vector<ReplayResult> results;
+
+    // выходы автомата сверяются пакетами в многополосном исполнителе: первая ошибка проигрывания
+    // (нет перехода или другой выход) и есть первое расхождение
+    auto more = true;
+    while (more) {
+        batch.clear();
+        while (!batch.full() && (more = trace ? shard.reader.next_trace(sequence) : shard.reader.next(sequence))) {
+            if (!sequence.has_outputs) {
+                throw std::runtime_error("Sequence at line " + std::to_string(sequence.line) + " has no expected outputs (conformance mode needs input/output pairs)");
+            }
+            batch.add(sequence);
+        }
+        shard.report.sequences += batch.size();
+        run_lanes(machine, batch, results, nullptr, simd);
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& result = results[i];
+            if (result.status == ReplayStatus::ok) {
+                continue;
+            }
+            auto input = batch.inputs[batch.offsets[i] + result.position];
+            auto expected = batch.outputs[batch.offsets[i] + result.position];
+
+            Divergence divergence;
+            divergence.line = trace ? batch.lines[i] + result.position : batch.lines[i];
+            divergence.position = result.position;
+            divergence.state = machine.state_names[result.state];
+            divergence.input = shard.reader.inputs().name(input);
+            divergence.expected = expected == no_transition ? "" : shard.reader.outputs().name(expected);
+            divergence.actual = result.status == ReplayStatus::output_mismatch ? machine.output_names[machine.step(result.state, input).output] : "";
+            shard.report.divergences.push_back(std::move(divergence));
+        }
+    }
 }
 
-bool is_valid_path(const pt::ptree& machine, const std::vector<std::string>& path, const std::string& initial_state) {
-    std::string current_state = initial_state;
+} // namespace
+
+ConformanceReport check_conformance(const CompiledMachine& machine, const std::string& sequences_file, unsigned int jobs, bool trace, SimdLevel simd) {
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    MappedFile file(sequences_file);
+    std::vector<ConformanceShard> shards;
+    shards.reserve(jobs);
+    for (const auto& [begin, end] : split_file(file, jobs, trace)) {
+        shards.emplace_back(machine, begin, end);
+    }
 
-    for (const auto& input : path) {
+    std::vector<std::exception_ptr> errors(shards.size());
+    auto run = [&](std::size_t i) {
         try {
-            auto transitions = machine.get_child("transitions").get_child(current_state);
-            auto next_state = transitions.get<std::string>(input + ".state");
-            current_state = next_state;
-        } catch (const pt::ptree_error& e) {
-            return false;
+            check_conformance_shard(machine, shards[i], trace, simd);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < shards.size(); ++i) {
+        workers.emplace_back(run, i);
+    }
+    run(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // номера строк: строки всех предыдущих кусков + локальный номер
+    ConformanceReport report;
+    std::size_t line_offset = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        auto& shard = shards[i];
+        report.sequences += shard.report.sequences;
+        for (auto& divergence : shard.report.divergences) {
+            divergence.line += line_offset;
+            report.divergences.push_back(std::move(divergence));
+        }
+        line_offset += shard.reader.next_line() - 1;
+    }
+    return report;
+}
+
+std::string divergence_message(const Divergence& divergence) {
+    auto where = "Line " + std::to_string(divergence.line) + ", position " + std::to_string(divergence.position + 1) +
+        " (state: " + divergence.state + ", input: " + divergence.input + "): ";
+    if (divergence.actual.empty()) {
+        return where + "transition not found";
+    }
+    return where + "expected " + divergence.expected + ", machine gives " + divergence.actual;
+}
+
+namespace {
+
+constexpr char coverage_map_magic[4] = {'C', 'M', 'A', 'P'};
+constexpr std::uint32_t coverage_map_version = 2;
+
+// FNV-1a
+void hash_bytes(std::uint64_t& hash, const void* data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+void hash_names(std::uint64_t& hash, const std::vector<std::string>& names, const std::vector<std::uint32_t>& order) {
+    for (auto id : order) {
+        hash_bytes(hash, names[id].data(), names[id].size() + 1);
+    }
+}
+
+// номера, упорядоченные по именам: в отличие от нумерации compile_machine не зависят от порядка ключей в JSON
+std::vector<std::uint32_t> order_by_name(const std::vector<std::string>& names) {
+    std::vector<std::uint32_t> order(names.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) { return names[a] < names[b]; });
+    return order;
+}
+
+// место номера в порядке имен
+std::vector<std::uint32_t> name_ranks(const std::vector<std::uint32_t>& order) {
+    std::vector<std::uint32_t> rank(order.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i) {
+        rank[order[i]] = i;
+    }
+    return rank;
+}
+
+// существующие переходы в порядке (имя состояния, имя входа) - порядок счетчиков в карте покрытия
+std::vector<std::size_t> cells_by_name(const CompiledMachine& machine) {
+    std::vector<std::size_t> cells;
+    cells.reserve(machine.n_transitions);
+    auto inputs = order_by_name(machine.input_names);
+    for (auto state : order_by_name(machine.state_names)) {
+        for (auto input : inputs) {
+            auto cell = machine.transition_id(state, input);
+            if (machine.table[cell].next_state != no_transition) {
+                cells.push_back(cell);
+            }
         }
     }
-    return true;
+    return cells;
+}
+
+template <typename T>
+void write_value(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+void read_value(std::ifstream& in, T& value) {
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
 }
 
-int find_max_path_len(const pt::ptree& transitions, const std::string& current_state, std::unordered_map<std::string, int>& memo, int input_length, std::unordered_set<std::string>& visited) {
-    if (visited.find(current_state) != visited.end()) {
-        return input_length;
+} // namespace
+
+// хеш учитывает имена, начальное состояние и таблицу переходов, т.е. карта подходит только к тому же автомату;
+// все номера берутся в порядке имен, поэтому перестановка ключей в JSON хеш не меняет
+std::uint64_t machine_hash(const CompiledMachine& machine) {
+    auto states = order_by_name(machine.state_names);
+    auto inputs = order_by_name(machine.input_names);
+    auto outputs = order_by_name(machine.output_names);
+    auto state_rank = name_ranks(states);
+    auto output_rank = name_ranks(outputs);
+
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    hash_names(hash, machine.state_names, states);
+    hash_names(hash, machine.input_names, inputs);
+    hash_names(hash, machine.output_names, outputs);
+    hash_bytes(hash, &state_rank[machine.initial_state], sizeof(std::uint32_t));
+    for (auto state : states) {
+        for (auto input : inputs) {
+            const auto& entry = machine.step(state, input);
+            auto next = entry.next_state == no_transition ? no_transition : state_rank[entry.next_state];
+            auto output = entry.next_state == no_transition ? no_transition : output_rank[entry.output];
+            hash_bytes(hash, &next, sizeof(next));
+            hash_bytes(hash, &output, sizeof(output));
+        }
     }
+    return hash;
+}
 
-    visited.insert(current_state);
+namespace {
 
-    if (memo.find(current_state) != memo.end()) {
-        visited.erase(current_state);
-        return memo[current_state];
+// нумерация в ширину из root состояний, еще не получивших номер; запись новых состояний добавляется в form.
+// В пробной записи (trial) номера, выданные этим обходом, пишутся относительно его начала ("+<смещение>"),
+// поэтому она не зависит от того, сколько состояний пронумеровано до обхода
+void canonical_component(const CompiledMachine& machine, const std::vector<std::uint32_t>& sorted_inputs, std::uint32_t root,
+    std::vector<std::uint32_t>& ids, std::vector<std::uint32_t>& order, std::string& form, bool trial = false) {
+    auto first = static_cast<std::uint32_t>(order.size());
+    auto id_string = [&](std::uint32_t id) {
+        return trial && id >= first ? "+" + std::to_string(id - first) : std::to_string(id);
+    };
+    ids[root] = static_cast<std::uint32_t>(order.size());
+    order.push_back(root);
+    for (size_t head = first; head < order.size(); ++head) {
+        auto state = order[head];
+        form += id_string(ids[state]) + ":";
+        for (auto input : sorted_inputs) {
+            const auto& entry = machine.step(state, input);
+            if (entry.next_state == no_transition) {
+                continue;
+            }
+            if (ids[entry.next_state] == no_transition) {
+                ids[entry.next_state] = static_cast<std::uint32_t>(order.size());
+                order.push_back(entry.next_state);
+            }
+            form += " " + machine.input_names[input] + "->" + id_string(ids[entry.next_state]) + "/" + machine.output_names[entry.output];
+        }
+        form += "\n";
     }
+}
 
-    int max_len = 0;
-    auto transitions_opt = transitions.get_child_optional(current_state);
-    if (!transitions_opt) {
-        visited.erase(current_state);
-        return max_len;
+// отмена пробной нумерации: состояния после numbered снова без номера, запись обрезается до form_size
+void canonical_rollback(std::vector<std::uint32_t>& ids, std::vector<std::uint32_t>& order, std::size_t numbered, std::string& form, std::size_t form_size) {
+    for (auto i = numbered; i < order.size(); ++i) {
+        ids[order[i]] = no_transition;
     }
+    order.resize(numbered);
+    form.resize(form_size);
+}
 
-    for (const auto& transition : transitions_opt.get()) {
-        if (!transition.second.get_optional<std::string>("state")) {
+// кандидаты в корни недостижимых частей: состояния истоковых компонент сильной связности среди еще не
+// пронумерованных (остальные достижимы из истоков и нумеруются их обходами). Корень в середине части дал бы
+// запись, зависящую от того, какое из одинаковых по записи состояний выбрано первым
+Bitset unreachable_roots(const CompiledMachine& machine, const std::vector<std::uint32_t>& ids) {
+    auto n_states = machine.n_states();
+    std::vector<std::uint32_t> index(n_states, no_transition);
+    std::vector<std::uint32_t> low(n_states);
+    std::vector<std::uint32_t> component(n_states, no_transition);
+    std::vector<std::uint32_t> stack;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> calls; // состояние и следующий вход
+    std::uint32_t counter = 0;
+    std::uint32_t components = 0;
+
+    // алгоритм Тарьяна без рекурсии: непронумерованное состояние с номером обхода без компоненты лежит в стеке
+    for (std::uint32_t start = 0; start < n_states; ++start) {
+        if (ids[start] != no_transition || index[start] != no_transition) {
             continue;
         }
+        index[start] = low[start] = counter++;
+        stack.push_back(start);
+        calls.emplace_back(start, 0);
+        while (!calls.empty()) {
+            auto state = calls.back().first;
+            auto input = calls.back().second;
+            if (input < machine.n_inputs) {
+                calls.back().second++;
+                auto next = machine.step(state, input).next_state;
+                if (next == no_transition || ids[next] != no_transition) {
+                    continue;
+                }
+                if (index[next] == no_transition) {
+                    index[next] = low[next] = counter++;
+                    stack.push_back(next);
+                    calls.emplace_back(next, 0);
+                } else if (component[next] == no_transition) {
+                    low[state] = std::min(low[state], index[next]);
+                }
+                continue;
+            }
+            if (low[state] == index[state]) {
+                for (auto member = no_transition; member != state;) {
+                    member = stack.back();
+                    stack.pop_back();
+                    component[member] = components;
+                }
+                components++;
+            }
+            calls.pop_back();
+            if (!calls.empty()) {
+                low[calls.back().first] = std::min(low[calls.back().first], low[state]);
+            }
+        }
+    }
 
-        std::string next_state = transition.second.get<std::string>("state");
+    std::vector<bool> has_predecessor(components, false);
+    for (std::uint32_t state = 0; state < n_states; ++state) {
+        if (ids[state] != no_transition) {
+            continue;
+        }
+        for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+            auto next = machine.step(state, input).next_state;
+            if (next != no_transition && ids[next] == no_transition && component[next] != component[state]) {
+                has_predecessor[component[next]] = true;
+            }
+        }
+    }
 
-        if (max_len == input_length) {
-            return input_length;
+    Bitset roots(n_states);
+    for (std::uint32_t state = 0; state < n_states; ++state) {
+        if (ids[state] == no_transition && !has_predecessor[component[state]]) {
+            roots.set(state);
         }
+    }
+    return roots;
+}
 
-        int len = 1 + find_max_path_len(transitions, next_state, memo, input_length, visited);
-        max_len = std::max(max_len, len);
+// классы непронумерованных состояний по мультимножеству входящих переходов (вход, выход): номер класса - место
+// мультимножества в порядке сортировки, т.е. зависит только от структуры автомата. Переходы в непронумерованное
+// состояние идут только из непронумерованных, поэтому до нумерации самого состояния класс не меняется
+std::vector<std::uint32_t> incoming_classes(const CompiledMachine& machine, const std::vector<std::uint32_t>& sorted_inputs, const std::vector<std::uint32_t>& ids) {
+    auto input_rank = name_ranks(sorted_inputs);
+    auto output_rank = name_ranks(order_by_name(machine.output_names));
+    std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> edges(machine.n_states());
+    for (size_t cell = 0; cell < machine.table.size(); ++cell) {
+        auto next = machine.table[cell].next_state;
+        if (next != no_transition && ids[next] == no_transition) {
+            edges[next].emplace_back(input_rank[cell % machine.n_inputs], output_rank[machine.table[cell].output]);
+        }
     }
 
-    memo[current_state] = max_len;
-    visited.erase(current_state);
-    return max_len;
+    std::vector<std::uint32_t> states;
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        if (ids[state] == no_transition) {
+            std::sort(edges[state].begin(), edges[state].end());
+            states.push_back(state);
+        }
+    }
+    std::sort(states.begin(), states.end(), [&](std::uint32_t a, std::uint32_t b) { return edges[a] < edges[b]; });
+    std::vector<std::uint32_t> classes(machine.n_states(), 0);
+    for (size_t i = 1; i < states.size(); ++i) {
+        classes[states[i]] = classes[states[i - 1]] + (edges[states[i]] != edges[states[i - 1]]);
+    }
+    return classes;
 }
 
-bool verify_etalon_in_sequences(const std::vector<std::vector<std::string>>& etalon, const std::vector<std::vector<std::string>>& sequences) {
-    if (etalon.size() > sequences.size()) {
-        return false;
+} // namespace
+
+std::string canonical_form(const CompiledMachine& machine) {
+    std::vector<std::uint32_t> sorted_inputs(machine.n_inputs);
+    for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+        sorted_inputs[input] = input;
     }
+    std::sort(sorted_inputs.begin(), sorted_inputs.end(), [&](std::uint32_t a, std::uint32_t b) { return machine.input_names[a] < machine.input_names[b]; });
 
-    std::unordered_set<std::vector<std::string>, VectorHash> sequences_set(sequences.begin(), sequences.end());
+    std::vector<std::uint32_t> ids(machine.n_states(), no_transition);
+    std::vector<std::uint32_t> order;
+    std::string form;
+    canonical_component(machine, sorted_inputs, machine.initial_state, ids, order, form);
 
-    for (const auto& etalon_vector : etalon) {
-        if (sequences_set.find(etalon_vector) == sequences_set.end()) {
-            return false;
+    // недостижимые части: каждый раз берется корень, дающий наименьшую пробную запись с уже назначенными номерами.
+    // К пробной записи добавляются классы входящих переходов ее состояний: без них одинаковые части с общими
+    // целями, по-разному связанные с остальными, выбирались бы по нумерации compile_machine. Пробная запись корня
+    // меняется, только если его часть задета очередным обходом, поэтому пробные обходы повторяются лишь для таких
+    // корней, а не для всех кандидатов на каждом шаге
+    auto roots = unreachable_roots(machine, ids);
+    auto incoming = incoming_classes(machine, sorted_inputs, ids);
+    std::set<std::pair<std::string, std::uint32_t>> trials;
+    std::unordered_map<std::uint32_t, std::string> trial_forms;
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> reached_by; // состояние - корни, чьи пробы его задели
+    auto try_root = [&](std::uint32_t root) {
+        auto numbered = order.size();
+        auto form_size = form.size();
+        canonical_component(machine, sorted_inputs, root, ids, order, form, true);
+        for (auto i = numbered; i < order.size(); ++i) {
+            reached_by[order[i]].push_back(root);
+            form += "<" + std::to_string(incoming[order[i]]);
+        }
+        auto& trial = trial_forms[root];
+        trial.assign(form, form_size, std::string::npos);
+        trials.emplace(trial, root);
+        canonical_rollback(ids, order, numbered, form, form_size);
+    };
+    for (std::uint32_t root = 0; root < machine.n_states(); ++root) {
+        if (roots.test(root)) {
+            try_root(root);
+        }
+    }
+
+    std::vector<std::uint32_t> affected;
+    while (!trials.empty()) {
+        auto root = trials.begin()->second;
+        trials.erase(trials.begin());
+        if (ids[root] != no_transition) {
+            continue;
+        }
+        auto numbered = order.size();
+        canonical_component(machine, sorted_inputs, root, ids, order, form);
+
+        affected.clear();
+        for (auto i = numbered; i < order.size(); ++i) {
+            for (auto other : reached_by[order[i]]) {
+                if (ids[other] == no_transition) {
+                    affected.push_back(other);
+                }
+            }
         }
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+        for (auto other : affected) {
+            trials.erase({trial_forms[other], other});
+            try_root(other);
+        }
+    }
+    return form;
+}
+
+std::string Hash128::to_string() const {
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0') << std::setw(16) << high << std::setw(16) << low;
+    return oss.str();
+}
+
+namespace {
+
+std::uint64_t rotl64(std::uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+std::uint64_t fmix64(std::uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+} // namespace
+
+Hash128 murmur3_128(const void* data, std::size_t length, std::uint32_t seed) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    const std::uint64_t c1 = 0x87c37b91114253d5ull;
+    const std::uint64_t c2 = 0x4cf5ad432745937full;
+    std::uint64_t h1 = seed;
+    std::uint64_t h2 = seed;
+
+    auto n_blocks = length / 16;
+    for (size_t i = 0; i < n_blocks; ++i) {
+        std::uint64_t k1, k2;
+        std::memcpy(&k1, bytes + i * 16, 8);
+        std::memcpy(&k2, bytes + i * 16 + 8, 8);
+
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // хвост: до 15 байт, младший байт первым
+    const auto* tail = bytes + n_blocks * 16;
+    std::uint64_t k1 = 0, k2 = 0;
+    auto rest = length & 15;
+    for (size_t i = rest; i > 8; --i) {
+        k2 ^= std::uint64_t{tail[i - 1]} << ((i - 9) * 8);
+    }
+    for (size_t i = std::min<std::size_t>(rest, 8); i > 0; --i) {
+        k1 ^= std::uint64_t{tail[i - 1]} << ((i - 1) * 8);
     }
+    if (rest > 8) {
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+    if (rest > 0) {
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+}
 
-    return true;
+CoverageMap coverage_to_map(const CompiledMachine& machine, const Coverage& coverage) {
+    CoverageMap map;
+    map.machine_hash = machine_hash(machine);
+    map.sequences = coverage.sequences;
+
+    // без счетчиков сохраняется хотя бы факт покрытия (1); начальное состояние покрыто и без единой
+    // последовательности, поэтому счетчик не может быть меньше отметки в states
+    for (auto state : order_by_name(machine.state_names)) {
+        std::uint64_t covered = coverage.states.test(state);
+        map.state_hits.push_back(coverage.counts_hits() ? std::max(coverage.state_hits[state], covered) : covered);
+    }
+    for (auto transition : cells_by_name(machine)) {
+        map.transition_hits.push_back(coverage.counts_hits() ? coverage.transition_hits[transition] : coverage.transitions.test(transition));
+    }
+    return map;
 }
 
-std::vector<Transition> find_transitions_from_state(const pt::ptree& machine, const std::string& state) {
-    std::vector<Transition> transitions;
-    auto transitions_node = machine.get_child("transitions");
-    auto state_node_opt = transitions_node.get_child_optional(state);
-    if (state_node_opt) {
-        for (const auto& item : state_node_opt.get()) {
-            Transition t;
-            t.current_state = state;
-            t.input_symbol = item.first;
-            t.next_state = item.second.get<std::string>("state");
-            t.output_symbol = item.second.get<std::string>("output");
-            transitions.push_back(t);
+Coverage map_to_coverage(const CompiledMachine& machine, const CoverageMap& map) {
+    if (map.machine_hash != machine_hash(machine)) {
+        throw std::runtime_error("Coverage map was built for another machine");
+    }
+
+    Coverage coverage(machine, true);
+    coverage.sequences = map.sequences;
+    size_t index = 0;
+    for (auto state : order_by_name(machine.state_names)) {
+        coverage.state_hits[state] = map.state_hits[index];
+        if (map.state_hits[index] > 0) {
+            coverage.states.set(state);
+        }
+        index++;
+    }
+
+    index = 0;
+    for (auto transition : cells_by_name(machine)) {
+        coverage.transition_hits[transition] = map.transition_hits[index];
+        if (map.transition_hits[index] > 0) {
+            coverage.transitions.set(transition);
         }
+        index++;
+    }
+    return coverage;
+}
+
+void merge_coverage_maps(CoverageMap& into, const CoverageMap& other) {
+    if (into.machine_hash != other.machine_hash || into.state_hits.size() != other.state_hits.size() || into.transition_hits.size() != other.transition_hits.size()) {
+        throw std::runtime_error("Coverage maps were built for different machines");
+    }
+
+    into.sequences += other.sequences;
+    for (size_t i = 0; i < into.state_hits.size(); ++i) {
+        into.state_hits[i] += other.state_hits[i];
+    }
+    for (size_t i = 0; i < into.transition_hits.size(); ++i) {
+        into.transition_hits[i] += other.transition_hits[i];
+    }
+}
+
+// формат (порядок байт машины): "CMAP", версия, хеш автомата, число последовательностей,
+// число состояний, число переходов, затем счетчики состояний и переходов (uint64)
+void write_coverage_map(const std::string& path, const CoverageMap& map) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+
+    out.write(coverage_map_magic, sizeof(coverage_map_magic));
+    write_value(out, coverage_map_version);
+    write_value(out, map.machine_hash);
+    write_value(out, map.sequences);
+    write_value(out, static_cast<std::uint64_t>(map.state_hits.size()));
+    write_value(out, static_cast<std::uint64_t>(map.transition_hits.size()));
+    out.write(reinterpret_cast<const char*>(map.state_hits.data()), map.state_hits.size() * sizeof(std::uint64_t));
+    out.write(reinterpret_cast<const char*>(map.transition_hits.data()), map.transition_hits.size() * sizeof(std::uint64_t));
+
+    if (!out) {
+        throw std::runtime_error("Failed to write coverage map: " + path);
+    }
+}
+
+CoverageMap read_coverage_map(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Failed to open file: " + path);
     }
 
-    return transitions;
-}
\ No newline at end of file
+    char magic[sizeof(coverage_map_magic)];
+    std::uint32_t version = 0;
+    in.read(magic, sizeof(magic));
+    read_value(in, version);
+    if (!in || !std::equal(std::begin(magic), std::end(magic), std::begin(coverage_map_magic)) || version != coverage_map_version) {
+        throw std::runtime_error("Not a coverage map: " + path);
+    }
+
+    CoverageMap map;
+    std::uint64_t n_states = 0;
+    std::uint64_t n_transitions = 0;
+    read_value(in, map.machine_hash);
+    read_value(in, map.sequences);
+    read_value(in, n_states);
+    read_value(in, n_transitions);
+    if (!in) {
+        throw std::runtime_error("Truncated coverage map: " + path);
+    }
+
+    map.state_hits.resize(n_states);
+    map.transition_hits.resize(n_transitions);
+    in.read(reinterpret_cast<char*>(map.state_hits.data()), n_states * sizeof(std::uint64_t));
+    in.read(reinterpret_cast<char*>(map.transition_hits.data()), n_transitions * sizeof(std::uint64_t));
+    if (!in) {
+        throw std::runtime_error("Truncated coverage map: " + path);
+    }
+    return map;
+}
+
+// требуются начальное состояние и все состояния, в которые ведут переходы
+Bitset required_states(const CompiledMachine& machine) {
+    Bitset required(machine.n_states());
+    required.set(machine.initial_state);
+    for (const auto& entry : machine.table) {
+        if (entry.next_state != no_transition) {
+            required.set(entry.next_state);
+        }
+    }
+    return required;
+}
+
+void print_coverage_report(std::ostream& out, const CompiledMachine& machine, const Coverage& coverage) {
+    auto required = required_states(machine);
+
+    std::size_t covered_states = 0;
+    std::ostringstream missing_states;
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        if (required.test(state)) {
+            if (coverage.states.test(state)) {
+                covered_states++;
+            } else {
+                missing_states << "  " << machine.state_names[state] << "\n";
+            }
+        }
+    }
+
+    std::size_t covered_transitions = 0;
+    std::ostringstream missing_transitions;
+    for (size_t transition = 0; transition < machine.table.size(); ++transition) {
+        if (machine.table[transition].next_state != no_transition) {
+            if (coverage.transitions.test(transition)) {
+                covered_transitions++;
+            } else {
+                missing_transitions << "  " << transition_to_string(machine, transition) << "\n";
+            }
+        }
+    }
+
+    out << "Machine hash: 0x" << std::hex << machine_hash(machine) << std::dec << "\n";
+    out << "Sequences: " << coverage.sequences << "\n";
+    out << "States covered: " << covered_states << "/" << required.count() << "\n";
+    out << "Transitions covered: " << covered_transitions << "/" << machine.n_transitions << "\n";
+    if (coverage.path_len() > 0) {
+        out << "Paths of length " << coverage.path_len() << " covered: " << coverage.paths.size() << "/" << count_paths(machine, coverage.path_len()) << "\n";
+    }
+    if (covered_states != required.count()) {
+        out << "States not covered:\n"
+            << missing_states.str();
+    }
+    if (covered_transitions != machine.n_transitions) {
+        out << "Transitions not covered:\n"
+            << missing_transitions.str();
+    }
+}
+
+bool HashSet64::insert(std::uint64_t key) {
+    if (key == 0) {
+        key = 1;
+    }
+    if ((count + 1) * 2 > slots.size()) {
+        grow();
+    }
+
+    auto mask = slots.size() - 1;
+    for (auto i = key & mask;; i = (i + 1) & mask) {
+        if (slots[i] == key) {
+            return false;
+        }
+        if (slots[i] == 0) {
+            slots[i] = key;
+            count++;
+            return true;
+        }
+    }
+}
+
+void HashSet64::merge(const HashSet64& other) {
+    for (auto key : other.slots) {
+        if (key != 0) {
+            insert(key);
+        }
+    }
+}
+
+void HashSet64::grow() {
+    std::vector<std::uint64_t> old_slots(std::max<std::size_t>(16, slots.size() * 2), 0);
+    old_slots.swap(slots);
+    count = 0;
+    for (auto key : old_slots) {
+        if (key != 0) {
+            insert(key);
+        }
+    }
+}
+
+Bitset dead_end_states(const CompiledMachine& machine) {
+    Bitset dead_ends(machine.n_states());
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        auto has_transitions = false;
+        for (std::uint32_t input = 0; input < machine.n_inputs && !has_transitions; ++input) {
+            has_transitions = machine.step(state, input).next_state != no_transition;
+        }
+        if (!has_transitions) {
+            dead_ends.set(state);
+        }
+    }
+    return dead_ends;
+}
+
+// длина самого длинного пути из начального состояния, ограниченная path_len (при достижимом цикле - path_len)
+std::uint32_t effective_path_len(const CompiledMachine& machine, std::uint32_t path_len) {
+    // топологическая сортировка достижимой части (алгоритм Кана)
+    std::vector<std::uint32_t> in_degree(machine.n_states(), 0);
+    Bitset reachable(machine.n_states());
+    std::vector<std::uint32_t> stack = {machine.initial_state};
+    reachable.set(machine.initial_state);
+    while (!stack.empty()) {
+        auto state = stack.back();
+        stack.pop_back();
+        for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+            auto next_state = machine.step(state, input).next_state;
+            if (next_state == no_transition) {
+                continue;
+            }
+            in_degree[next_state]++;
+            if (!reachable.test(next_state)) {
+                reachable.set(next_state);
+                stack.push_back(next_state);
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> order;
+    std::vector<std::uint32_t> ready;
+    if (in_degree[machine.initial_state] == 0) {
+        ready.push_back(machine.initial_state);
+    }
+    while (!ready.empty()) {
+        auto state = ready.back();
+        ready.pop_back();
+        order.push_back(state);
+        for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+            auto next_state = machine.step(state, input).next_state;
+            if (next_state != no_transition && --in_degree[next_state] == 0) {
+                ready.push_back(next_state);
+            }
+        }
+    }
+    if (order.size() != reachable.count()) {
+        return path_len;
+    }
+
+    std::vector<std::uint32_t> longest(machine.n_states(), 0);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+            auto next_state = machine.step(*it, input).next_state;
+            if (next_state != no_transition) {
+                longest[*it] = std::max(longest[*it], longest[next_state] + 1);
+            }
+        }
+    }
+    return std::min(longest[machine.initial_state], path_len);
+}
+
+// число целевых путей (динамика по длине): paths[d][s] - число путей длины d из s (или короче, если ведут в тупик)
+std::uint64_t count_paths(const CompiledMachine& machine, std::uint32_t path_len) {
+    auto dead_ends = dead_end_states(machine);
+    if (path_len == 0 || dead_ends.test(machine.initial_state)) {
+        return 0;
+    }
+
+    constexpr auto saturated = std::numeric_limits<std::uint64_t>::max();
+    std::vector<std::uint64_t> paths(machine.n_states(), 1);
+    std::vector<std::uint64_t> next_paths(machine.n_states());
+    for (std::uint32_t depth = 1; depth <= path_len; ++depth) {
+        for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+            if (dead_ends.test(state)) {
+                next_paths[state] = 1;
+                continue;
+            }
+            std::uint64_t total = 0;
+            for (std::uint32_t input = 0; input < machine.n_inputs; ++input) {
+                auto next_state = machine.step(state, input).next_state;
+                if (next_state != no_transition) {
+                    total = (saturated - total < paths[next_state]) ? saturated : total + paths[next_state];
+                }
+            }
+            next_paths[state] = total;
+        }
+        paths.swap(next_paths);
+    }
+    return paths[machine.initial_state];
+}
+
+std::vector<std::vector<std::size_t>> top_up_sequences(const CompiledMachine& machine, const Coverage& coverage, bool cover_transitions) {
+    auto states = coverage.states;
+    auto transitions = coverage.transitions;
+    auto required = required_states(machine);
+
+    // дерево обхода в ширину из начального состояния: parent_cell - последний переход кратчайшего префикса
+    std::vector<std::uint32_t> depth(machine.n_states(), no_transition);
+    std::vector<std::size_t> parent_cell(machine.n_states(), machine.table.size());
+    std::vector<std::uint32_t> queue = {machine.initial_state};
+    depth[machine.initial_state] = 0;
+    for (size_t head = 0; head < queue.size(); ++head) {
+        auto u = queue[head];
+        for (auto cell = machine.transition_id(u, 0); cell < machine.transition_id(u + 1, 0); ++cell) {
+            auto next = machine.table[cell].next_state;
+            if (next != no_transition && depth[next] == no_transition) {
+                depth[next] = depth[u] + 1;
+                parent_cell[next] = cell;
+                queue.push_back(next);
+            }
+        }
+    }
+
+    // достижимые пробелы (ячейки таблицы или состояния) в порядке обхода, то есть по неубыванию глубины
+    std::vector<std::size_t> gaps;
+    for (auto u : queue) {
+        if (!cover_transitions) {
+            if (required.test(u) && !states.test(u)) {
+                gaps.push_back(u);
+            }
+            continue;
+        }
+        for (auto cell = machine.transition_id(u, 0); cell < machine.transition_id(u + 1, 0); ++cell) {
+            if (machine.table[cell].next_state != no_transition && !transitions.test(cell)) {
+                gaps.push_back(cell);
+            }
+        }
+    }
+
+    // от самых глубоких: кратчайший префикс пробела покрывает и пробелы на своем пути, они затем пропускаются,
+    // поэтому время линейно по размеру автомата и выдачи
+    std::vector<std::vector<std::size_t>> sequences;
+    for (auto gap = gaps.rbegin(); gap != gaps.rend(); ++gap) {
+        std::vector<std::size_t> sequence;
+        std::uint32_t state;
+        if (cover_transitions) {
+            if (transitions.test(*gap)) {
+                continue;
+            }
+            sequence.push_back(*gap);
+            state = static_cast<std::uint32_t>(*gap / machine.n_inputs);
+        } else {
+            if (states.test(*gap)) {
+                continue;
+            }
+            state = static_cast<std::uint32_t>(*gap);
+        }
+        for (; state != machine.initial_state; state = static_cast<std::uint32_t>(parent_cell[state] / machine.n_inputs)) {
+            sequence.push_back(parent_cell[state]);
+        }
+
+        // пустой префикс - начальное состояние, его покрывает начало любой последовательности
+        if (sequence.empty()) {
+            continue;
+        }
+        std::reverse(sequence.begin(), sequence.end());
+        for (auto cell : sequence) {
+            transitions.set(cell);
+            states.set(machine.table[cell].next_state);
+        }
+        sequences.push_back(std::move(sequence));
+    }
+    return sequences;
+}
+
+void write_sequences(const std::string& path, const CompiledMachine& machine, const std::vector<std::vector<std::size_t>>& sequences) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    for (const auto& sequence : sequences) {
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            if (i > 0) {
+                out << ",";
+            }
+            out << machine.input_names[sequence[i] % machine.n_inputs] << io_separator << machine.output_names[machine.table[sequence[i]].output];
+        }
+        out << "\n";
+    }
+}
+
+namespace {
+
+// потоковый разбор JSON-описания автомата без дерева ptree: состояния и переходы сообщаются по мере чтения файла;
+// ключи, кроме initial_state и transitions (и state/output у перехода), пропускаются, как и при get/get_child
+class MachineScanner {
+  public:
+    MachineScanner(const std::string& path, const char* begin, const char* end) : path(path), first(begin), current(begin), last(end) {}
+
+    // on_state(имя) - начало состояния, on_transition(вход, цель, выход) - его переход; результат - начальное состояние
+    template <typename OnState, typename OnTransition>
+    std::string scan(OnState on_state, OnTransition on_transition) {
+        std::string initial_state;
+        auto has_initial = false;
+        auto has_transitions = false;
+        expect('{');
+        for (auto more = !consume('}'); more; more = next_member()) {
+            auto key = read_key();
+            if (key == "initial_state") {
+                initial_state = read_string();
+                has_initial = true;
+            } else if (key == "transitions") {
+                scan_transitions(on_state, on_transition);
+                has_transitions = true;
+            } else {
+                skip_value();
+            }
+        }
+        if (!has_transitions) {
+            throw std::runtime_error(path + ": no such node (transitions)");
+        }
+        if (!has_initial) {
+            throw std::runtime_error(path + ": no such node (initial_state)");
+        }
+        return initial_state;
+    }
+
+  private:
+    template <typename OnState, typename OnTransition>
+    void scan_transitions(OnState on_state, OnTransition on_transition) {
+        expect('{');
+        for (auto more = !consume('}'); more; more = next_member()) {
+            on_state(read_key());
+            // состояние без переходов записывается пустой строкой
+            skip_space();
+            if (current < last && *current != '{') {
+                read_string();
+                continue;
+            }
+            expect('{');
+            for (auto more_inputs = !consume('}'); more_inputs; more_inputs = next_member()) {
+                auto input = read_key();
+                std::string target, output;
+                auto has_target = false;
+                auto has_output = false;
+                expect('{');
+                for (auto more_fields = !consume('}'); more_fields; more_fields = next_member()) {
+                    auto field = read_key();
+                    if (field == "state" && !has_target) {
+                        target = read_string();
+                        has_target = true;
+                    } else if (field == "output" && !has_output) {
+                        output = read_string();
+                        has_output = true;
+                    } else {
+                        skip_value();
+                    }
+                }
+                if (!has_target || !has_output) {
+                    throw std::runtime_error(path + ": no such node (" + (has_target ? "output" : "state") + ") in transition " + input);
+                }
+                on_transition(input, target, output);
+            }
+        }
+    }
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error(path + "(offset " + std::to_string(current - first) + "): " + what);
+    }
+
+    void skip_space() {
+        while (current < last && (*current == ' ' || *current == '\n' || *current == '\r' || *current == '\t')) {
+            ++current;
+        }
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (current < last && *current == c) {
+            ++current;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    // после значения члена объекта: ',' - дальше следующий, '}' - конец объекта
+    bool next_member() {
+        if (consume(',')) {
+            return true;
+        }
+        expect('}');
+        return false;
+    }
+
+    std::string read_key() {
+        auto key = read_string();
+        expect(':');
+        return key;
+    }
+
+    std::string read_string() {
+        expect('"');
+        std::string value;
+        while (current < last && *current != '"') {
+            if (*current != '\\') {
+                value += *current++;
+                continue;
+            }
+            if (++current == last) {
+                break;
+            }
+            switch (*current++) {
+            case '"': value += '"'; break;
+            case '\\': value += '\\'; break;
+            case '/': value += '/'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u': append_utf8(value, read_hex4()); break;
+            default: fail("invalid escape in string");
+            }
+        }
+        if (current == last) {
+            fail("unterminated string");
+        }
+        ++current;
+        return value;
+    }
+
+    std::uint32_t read_hex4() {
+        if (last - current < 4) {
+            fail("invalid \\u escape");
+        }
+        std::uint32_t code = 0;
+        for (int i = 0; i < 4; ++i) {
+            auto c = *current++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') {
+                code |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                code |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                code |= c - 'A' + 10;
+            } else {
+                fail("invalid \\u escape");
+            }
+        }
+        return code;
+    }
+
+    static void append_utf8(std::string& value, std::uint32_t code) {
+        if (code < 0x80) {
+            value += static_cast<char>(code);
+        } else if (code < 0x800) {
+            value += static_cast<char>(0xC0 | (code >> 6));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            value += static_cast<char>(0xE0 | (code >> 12));
+            value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    // значение, которое не нужно: строка, число, литерал, объект или массив
+    void skip_value() {
+        skip_space();
+        if (current == last) {
+            fail("unexpected end of data");
+        }
+        if (*current == '"') {
+            read_string();
+            return;
+        }
+        if (*current == '{' || *current == '[') {
+            auto close = *current == '{' ? '}' : ']';
+            ++current;
+            if (consume(close)) {
+                return;
+            }
+            do {
+                if (close == '}') {
+                    read_key();
+                }
+                skip_value();
+            } while (consume(','));
+            expect(close);
+            return;
+        }
+        auto start = current;
+        while (current < last && std::strchr(",:}] \n\r\t", *current) == nullptr) {
+            ++current;
+        }
+        if (current == start) {
+            fail("unexpected character");
+        }
+    }
+
+    std::string path;
+    const char* first;
+    const char* current;
+    const char* last;
+};
+
+} // namespace
+
+void json_to_store(const std::string& json_path, const std::string& directory, std::uint32_t shard_states) {
+    MappedFile file(json_path);
+
+    // первый проход: номера состояний-источников, входов и выходов - в том же порядке, что и у compile_machine
+    std::vector<std::string> state_names, input_names, output_names; // state_names - только состояния без своих строк
+    std::unordered_map<std::string, std::uint32_t> state_ids, input_ids, output_ids;
+    auto initial_state = MachineScanner(json_path, file.begin(), file.end()).scan(
+        [&](const std::string& state) {
+            if (!state_ids.emplace(state, static_cast<std::uint32_t>(state_ids.size())).second) {
+                throw std::runtime_error(json_path + ": state " + state + " is described more than once");
+            }
+        },
+        [&](const std::string& input, const std::string&, const std::string& output) {
+            intern_name(input, input_names, input_ids);
+            intern_name(output, output_names, output_ids);
+        });
+    auto n_sources = static_cast<std::uint32_t>(state_ids.size());
+    auto n_inputs = static_cast<std::uint32_t>(input_names.size());
+
+    // второй проход: строка состояния пишется, как только прочитаны его переходы; состояния, встреченные только
+    // как цели, получают номера после источников по первому упоминанию (их имена - единственное, что копится в памяти)
+    TransitionStoreWriter writer(directory, shard_states, input_names, output_names);
+    std::vector<TableEntry> row(n_inputs);
+    std::string current_state;
+    auto has_state = false;
+    auto flush = [&]() {
+        if (has_state) {
+            writer.add_state(current_state, row.data());
+        }
+        std::fill(row.begin(), row.end(), TableEntry{no_transition, no_transition});
+    };
+    MachineScanner(json_path, file.begin(), file.end()).scan(
+        [&](const std::string& state) {
+            flush();
+            current_state = state;
+            has_state = true;
+        },
+        [&](const std::string& input, const std::string& target, const std::string& output) {
+            // цель нумеруется и у отброшенного повторного перехода, как в compile_machine
+            auto it = state_ids.find(target);
+            if (it == state_ids.end()) {
+                it = state_ids.emplace(target, n_sources + static_cast<std::uint32_t>(state_names.size())).first;
+                state_names.push_back(target);
+            }
+            auto& entry = row[input_ids.at(input)];
+            // как и get_child, при повторяющихся ключах используется первый переход
+            if (entry.next_state == no_transition) {
+                entry.next_state = it->second;
+                entry.output = output_ids.at(output);
+            }
+        });
+    flush();
+
+    for (const auto& name : state_names) {
+        writer.add_state(name, row.data());
+    }
+    auto initial = state_ids.find(initial_state);
+    if (initial == state_ids.end()) {
+        writer.add_state(initial_state, row.data());
+    }
+    writer.finish(initial != state_ids.end() ? initial->second : n_sources + static_cast<std::uint32_t>(state_names.size()));
+}
+
+void check_store_coverage(const TransitionStore& store, const std::string& sequences_file, const std::string& mode, const std::string& work_dir) {
+    // для разбора последовательностей нужны только имена входов и выходов
+    CompiledMachine symbols;
+    symbols.input_names = store.input_names();
+    symbols.output_names = store.output_names();
+    for (std::uint32_t i = 0; i < symbols.input_names.size(); ++i) {
+        symbols.input_ids.emplace(symbols.input_names[i], i);
+    }
+    for (std::uint32_t i = 0; i < symbols.output_names.size(); ++i) {
+        symbols.output_ids.emplace(symbols.output_names[i], i);
+    }
+    symbols.n_inputs = store.n_inputs();
+
+    TemporaryDirectory temporary(work_dir);
+    auto n_cells = static_cast<std::uint64_t>(store.n_states()) * store.n_inputs();
+    DiskBitset covered_states(temporary.path("coverage_states.bits"), store.n_states());
+    DiskBitset covered_transitions(temporary.path("coverage_transitions.bits"), n_cells);
+
+    MappedFile file(sequences_file);
+    SequenceReader reader(symbols, file.begin(), file.end());
+    ParsedSequence sequence;
+    covered_states.set(store.initial_state());
+    while (reader.next(sequence)) {
+        auto state = store.initial_state();
+        for (size_t i = 0; i < sequence.inputs.size(); ++i) {
+            auto input = sequence.inputs[i];
+            if (input >= store.n_inputs() || store.step(state, input).next_state == no_transition) {
+                throw std::runtime_error("Transition not found for state: " + store.state_name(state) + " with input: " + reader.inputs().name(input) + " (line " + std::to_string(sequence.line) + ")\n");
+            }
+            const auto& entry = store.step(state, input);
+            if (sequence.outputs[i] != no_transition && sequence.outputs[i] != entry.output) {
+                throw std::runtime_error("Output mismatch at line " + std::to_string(sequence.line) + ", position " + std::to_string(i + 1) +
+                    " (state: " + store.state_name(state) + ", input: " + reader.inputs().name(input) + "): expected " +
+                    reader.outputs().name(sequence.outputs[i]) + ", machine gives " + store.output_names()[entry.output] + "\n");
+            }
+            covered_transitions.set(static_cast<std::uint64_t>(state) * store.n_inputs() + input);
+            covered_states.set(entry.next_state);
+            state = entry.next_state;
+        }
+    }
+
+    std::vector<TableEntry> rows;
+    std::ostringstream missing;
+    auto has_missing = false;
+    if (mode == "states") {
+        DiskBitset required(temporary.path("required_states.bits"), store.n_states());
+        required.set(store.initial_state());
+        for (std::uint32_t shard = 0; shard < store.n_shards(); ++shard) {
+            if (shard + 1 < store.n_shards()) {
+                store.prefetch_shard(shard + 1);
+            }
+            store.load_shard(shard, rows);
+            for (const auto& entry : rows) {
+                if (entry.next_state != no_transition) {
+                    required.set(entry.next_state);
+                }
+            }
+        }
+        for (std::uint32_t state = 0; state < store.n_states(); ++state) {
+            if (required.test(state) && !covered_states.test(state)) {
+                missing << (has_missing ? ", " : "") << store.state_name(state);
+                has_missing = true;
+            }
+        }
+        if (has_missing) {
+            throw std::runtime_error("States not covered: " + missing.str() + "\n");
+        }
+        return;
+    }
+
+    for (std::uint32_t shard = 0; shard < store.n_shards(); ++shard) {
+        if (shard + 1 < store.n_shards()) {
+            store.prefetch_shard(shard + 1);
+        }
+        store.load_shard(shard, rows);
+        auto first_cell = static_cast<std::uint64_t>(shard) * store.shard_states() * store.n_inputs();
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (rows[i].next_state != no_transition && !covered_transitions.test(first_cell + i)) {
+                auto state = static_cast<std::uint32_t>((first_cell + i) / store.n_inputs());
+                missing << (has_missing ? "\n" : "") << "[" << store.state_name(state) << " -> " << store.state_name(rows[i].next_state)
+                        << " (input: " << store.input_names()[i % store.n_inputs()] << ", output: " << store.output_names()[rows[i].output] << ")]";
+                has_missing = true;
+            }
+        }
+    }
+    if (has_missing) {
+        throw std::runtime_error("Transitions not covered: " + missing.str() + "\n");
+    }
+}
+
+Composition parse_composition(const std::string& name) {
+    if (name == "serial") {
+        return Composition::serial;
+    }
+    if (name == "parallel") {
+        return Composition::parallel;
+    }
+    if (name == "product") {
+        return Composition::product;
+    }
+    throw std::invalid_argument("Invalid composition kind: " + name + ". There're only 3 kinds: serial/parallel/product");
+}
+
+StateArena::StateArena(std::size_t width) : width(std::max<std::size_t>(1, width)) {}
+
+std::uint32_t* StateArena::allocate() {
+    if (used == block_tuples) {
+        blocks.emplace_back(new std::uint32_t[block_tuples * width]);
+        used = 0;
+    }
+    return blocks.back().get() + width * used++;
+}
+
+ComposedMachine::ComposedMachine(std::vector<CompiledMachine> components_, Composition kind)
+    : components(std::move(components_)), kind(kind), arena(components.size()), scratch(components.size()) {
+    if (components.size() < 2) {
+        throw std::invalid_argument("Composition needs at least 2 machines");
+    }
+
+    // входы композиции: serial - входы первого компонента, product - общие для всех, parallel - все (в порядке компонентов)
+    std::unordered_map<std::string, std::uint32_t> input_ids;
+    for (size_t c = 0; c < components.size(); ++c) {
+        if (kind == Composition::serial && c > 0) {
+            break;
+        }
+        for (const auto& name : components[c].input_names) {
+            auto shared = true;
+            for (size_t other = 0; kind == Composition::product && other < components.size(); ++other) {
+                shared = shared && components[other].input_ids.count(name);
+            }
+            if (shared && input_ids.emplace(name, static_cast<std::uint32_t>(input_names.size())).second) {
+                input_names.push_back(name);
+            }
+        }
+    }
+
+    component_inputs.assign(components.size(), std::vector<std::uint32_t>(input_names.size(), no_transition));
+    for (size_t c = 0; c < components.size(); ++c) {
+        for (std::uint32_t input = 0; input < input_names.size(); ++input) {
+            auto it = components[c].input_ids.find(input_names[input]);
+            if (it != components[c].input_ids.end()) {
+                component_inputs[c][input] = it->second;
+            }
+        }
+    }
+
+    if (kind == Composition::serial) {
+        links.resize(components.size());
+        for (size_t c = 0; c + 1 < components.size(); ++c) {
+            for (const auto& output : components[c].output_names) {
+                auto it = components[c + 1].input_ids.find(output);
+                links[c].push_back(it != components[c + 1].input_ids.end() ? it->second : no_transition);
+            }
+        }
+    }
+
+    for (size_t c = 0; c < components.size(); ++c) {
+        scratch[c] = components[c].initial_state;
+    }
+    intern_state(scratch.data());
+}
+
+std::string ComposedMachine::state_name(std::uint32_t state) const {
+    std::string name;
+    for (size_t c = 0; c < components.size(); ++c) {
+        if (c > 0) {
+            name += "|";
+        }
+        name += components[c].state_names[tuples[state][c]];
+    }
+    return name;
+}
+
+TableEntry ComposedMachine::step(std::uint32_t state, std::uint32_t input) {
+    auto cell = static_cast<std::size_t>(state) * input_names.size() + input;
+    if (table[cell].next_state != not_computed) {
+        return table[cell];
+    }
+
+    const auto* tuple = tuples[state];
+    auto defined = true;
+    std::string output;
+
+    if (kind == Composition::serial) {
+        auto symbol = component_inputs[0][input];
+        for (size_t c = 0; c < components.size() && defined; ++c) {
+            const auto& entry = components[c].step(tuple[c], symbol);
+            if (entry.next_state == no_transition) {
+                defined = false;
+                break;
+            }
+            scratch[c] = entry.next_state;
+            if (c + 1 < components.size()) {
+                symbol = links[c][entry.output];
+                defined = symbol != no_transition;
+            } else {
+                output = components[c].output_names[entry.output];
+            }
+        }
+    } else {
+        for (size_t c = 0; c < components.size() && defined; ++c) {
+            auto symbol = component_inputs[c][input];
+            if (symbol == no_transition) {
+                scratch[c] = tuple[c];
+                continue;
+            }
+            const auto& entry = components[c].step(tuple[c], symbol);
+            if (entry.next_state == no_transition) {
+                defined = false;
+                break;
+            }
+            scratch[c] = entry.next_state;
+            if (!output.empty()) {
+                output += "|";
+            }
+            output += components[c].output_names[entry.output];
+        }
+    }
+
+    TableEntry entry{no_transition, no_transition};
+    if (defined) {
+        // intern_state может расширить table, поэтому ячейка заполняется после
+        entry.next_state = intern_state(scratch.data());
+        entry.output = intern_output(output);
+    }
+    table[cell] = entry;
+    return entry;
+}
+
+CompiledMachine ComposedMachine::compile(std::size_t max_states) {
+    // новые состояния получают номера в порядке обнаружения, поэтому проход по номерам - обход в ширину
+    for (std::uint32_t state = 0; state < n_states(); ++state) {
+        if (n_states() > max_states) {
+            throw std::runtime_error("Composition has more than " + std::to_string(max_states) + " reachable states");
+        }
+        for (std::uint32_t input = 0; input < n_inputs(); ++input) {
+            step(state, input);
+        }
+    }
+
+    CompiledMachine compiled;
+    for (std::uint32_t state = 0; state < n_states(); ++state) {
+        compiled.state_ids.emplace(state_name(state), state);
+        compiled.state_names.push_back(state_name(state));
+    }
+    compiled.input_names = input_names;
+    for (std::uint32_t input = 0; input < n_inputs(); ++input) {
+        compiled.input_ids.emplace(input_names[input], input);
+    }
+    compiled.output_names = output_names;
+    compiled.output_ids = output_ids;
+    compiled.initial_state = initial_state();
+    compiled.n_inputs = n_inputs();
+    compiled.table = table;
+    for (const auto& entry : table) {
+        compiled.n_transitions += entry.next_state != no_transition;
+    }
+    return compiled;
+}
+
+std::uint64_t ComposedMachine::tuple_hash(const std::uint32_t* tuple) const {
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t c = 0; c < components.size(); ++c) {
+        hash = (hash ^ tuple[c]) * 0x100000001b3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+std::uint32_t ComposedMachine::intern_state(const std::uint32_t* tuple) {
+    if ((tuples.size() + 1) * 2 > slots.size()) {
+        grow_slots();
+    }
+
+    auto mask = slots.size() - 1;
+    auto width = components.size() * sizeof(std::uint32_t);
+    for (auto slot = tuple_hash(tuple) & mask;; slot = (slot + 1) & mask) {
+        auto state = slots[slot];
+        if (state == no_transition) {
+            auto stored = arena.allocate();
+            std::memcpy(stored, tuple, width);
+            state = static_cast<std::uint32_t>(tuples.size());
+            tuples.push_back(stored);
+            slots[slot] = state;
+            table.resize(table.size() + input_names.size(), {not_computed, not_computed});
+            return state;
+        }
+        if (std::memcmp(tuples[state], tuple, width) == 0) {
+            return state;
+        }
+    }
+}
+
+std::uint32_t ComposedMachine::intern_output(const std::string& output) {
+    auto it = output_ids.find(output);
+    if (it != output_ids.end()) {
+        return it->second;
+    }
+    auto id = static_cast<std::uint32_t>(output_names.size());
+    output_names.push_back(output);
+    output_ids.emplace(output, id);
+    return id;
+}
+
+void ComposedMachine::grow_slots() {
+    slots.assign(std::max<std::size_t>(16, slots.size() * 2), no_transition);
+    auto mask = slots.size() - 1;
+    for (std::uint32_t state = 0; state < tuples.size(); ++state) {
+        auto slot = tuple_hash(tuples[state]) & mask;
+        while (slots[slot] != no_transition) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = state;
+    }
+}
+
+ConformanceReport check_conformance(ComposedMachine& machine, const std::string& sequences_file, bool trace) {
+    // для разбора последовательностей нужны только имена входов; выходы композиции появляются по ходу, поэтому сверяются по именам
+    CompiledMachine symbols;
+    symbols.input_names = machine.inputs();
+    for (std::uint32_t i = 0; i < symbols.input_names.size(); ++i) {
+        symbols.input_ids.emplace(symbols.input_names[i], i);
+    }
+    symbols.n_inputs = machine.n_inputs();
+
+    MappedFile file(sequences_file);
+    SequenceReader reader(symbols, file.begin(), file.end());
+    ParsedSequence sequence;
+    ConformanceReport report;
+    while (trace ? reader.next_trace(sequence) : reader.next(sequence)) {
+        if (!sequence.has_outputs) {
+            throw std::runtime_error("Sequence at line " + std::to_string(sequence.line) + " has no expected outputs (conformance mode needs input/output pairs)");
+        }
+        report.sequences++;
+
+        auto state = machine.initial_state();
+        for (size_t i = 0; i < sequence.inputs.size(); ++i) {
+            auto input = sequence.inputs[i];
+            auto expected = sequence.outputs[i];
+            auto entry = input < machine.n_inputs() ? machine.step(state, input) : TableEntry{no_transition, no_transition};
+            if (entry.next_state != no_transition && (expected == no_transition || reader.outputs().name(expected) == machine.output_name(entry.output))) {
+                state = entry.next_state;
+                continue;
+            }
+
+            Divergence divergence;
+            divergence.line = trace ? sequence.line + i : sequence.line;
+            divergence.position = i;
+            divergence.state = machine.state_name(state);
+            divergence.input = reader.inputs().name(input);
+            divergence.expected = expected == no_transition ? "" : reader.outputs().name(expected);
+            divergence.actual = entry.next_state == no_transition ? "" : machine.output_name(entry.output);
+            report.divergences.push_back(std::move(divergence));
+            break;
+        }
+    }
+    return report;
+}
+
+std::uint32_t composition_to_store(ComposedMachine& machine, const std::string& directory, std::uint32_t shard_states, std::size_t max_states) {
+    TransitionStoreWriter writer(directory, shard_states, machine.inputs(), machine.outputs());
+
+    // как и в compile: проход по номерам - обход в ширину, строка состояния готова, как только вычислены все его переходы
+    std::vector<TableEntry> row(machine.n_inputs());
+    for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+        if (machine.n_states() > max_states) {
+            throw std::runtime_error("Composition has more than " + std::to_string(max_states) + " reachable states");
+        }
+        for (std::uint32_t input = 0; input < machine.n_inputs(); ++input) {
+            row[input] = machine.step(state, input);
+        }
+        writer.add_state(machine.state_name(state), row.data());
+    }
+
+    writer.set_output_names(machine.outputs());
+    writer.finish(machine.initial_state());
+    return machine.n_states();
+}
+
+MachineCache::MachineCache(std::size_t capacity) : capacity(std::max<std::size_t>(1, capacity)) {}
+
+std::shared_ptr<const CompiledMachine> MachineCache::get(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    std::int64_t mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(path);
+        if (it != index.end() && it->second->mtime == mtime) {
+            entries.splice(entries.begin(), entries, it->second);
+            return entries.front().machine;
+        }
+    }
+
+    // компиляция вне блокировки: одновременные запросы к разным автоматам не ждут друг друга
+    auto machine = std::make_shared<const CompiledMachine>(compile_machine(json_to_machine(path)));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(path);
+    if (it != index.end()) {
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    entries.push_front({path, mtime, machine});
+    index[path] = entries.begin();
+    if (entries.size() > capacity) {
+        index.erase(entries.back().path);
+        entries.pop_back();
+    }
+    return machine;
+}
+
+ThreadPool::ThreadPool(unsigned int workers) {
+    for (unsigned int i = 0; i < std::max(1u, workers); ++i) {
+        threads.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    task_ready.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this] { return tasks.empty() && running == 0; });
+}
+
+void ThreadPool::work() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            running++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running--;
+            if (tasks.empty() && running == 0) {
+                all_done.notify_all();
+            }
+        }
+    }
+}
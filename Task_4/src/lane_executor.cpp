@@ -0,0 +1,283 @@
+#include "functions.hpp"
+
+#include <immintrin.h>
+
+void SequenceBatch::clear() {
+    inputs.clear();
+    outputs.clear();
+    offsets.assign(1, 0);
+    lines.clear();
+}
+
+void SequenceBatch::add(const ParsedSequence& sequence) {
+    inputs.insert(inputs.end(), sequence.inputs.begin(), sequence.inputs.end());
+    if (sequence.has_outputs) {
+        outputs.insert(outputs.end(), sequence.outputs.begin(), sequence.outputs.end());
+    } else {
+        outputs.resize(inputs.size(), no_transition);
+    }
+    offsets.push_back(inputs.size());
+    lines.push_back(sequence.line);
+}
+
+ParsedSequence SequenceBatch::sequence(std::size_t index) const {
+    ParsedSequence sequence;
+    sequence.line = lines[index];
+    sequence.inputs.assign(inputs.begin() + offsets[index], inputs.begin() + offsets[index + 1]);
+    sequence.outputs.assign(outputs.begin() + offsets[index], outputs.begin() + offsets[index + 1]);
+    sequence.has_outputs = std::any_of(sequence.outputs.begin(), sequence.outputs.end(), [](std::uint32_t output) { return output != no_transition; });
+    return sequence;
+}
+
+SimdLevel parse_simd_level(const std::string& name) {
+    if (name == "auto") {
+        return SimdLevel::automatic;
+    }
+    if (name == "scalar") {
+        return SimdLevel::scalar;
+    }
+    if (name == "avx2") {
+        return SimdLevel::avx2;
+    }
+    if (name == "avx512") {
+        return SimdLevel::avx512;
+    }
+    throw std::invalid_argument("Invalid SIMD level: " + name + ". There're only 4 levels: auto/scalar/avx2/avx512");
+}
+
+SimdLevel resolve_simd_level(SimdLevel level) {
+    __builtin_cpu_init();
+    auto has_avx2 = __builtin_cpu_supports("avx2");
+    auto has_avx512 = __builtin_cpu_supports("avx512f");
+    if (level == SimdLevel::automatic) {
+        return has_avx512 ? SimdLevel::avx512 : has_avx2 ? SimdLevel::avx2 : SimdLevel::scalar;
+    }
+    if ((level == SimdLevel::avx2 && !has_avx2) || (level == SimdLevel::avx512 && !has_avx512)) {
+        throw std::runtime_error(std::string("CPU does not support ") + (level == SimdLevel::avx2 ? "avx2" : "avx512"));
+    }
+    return level;
+}
+
+namespace {
+
+// скалярный исполнитель: последовательности пакета по одной, прямо по общим массивам
+void run_scalar(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results, Coverage* coverage) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto state = machine.initial_state;
+        if (coverage) {
+            coverage->mark_state(state);
+        }
+        results[i] = {ReplayStatus::ok, batch.offsets[i + 1] - batch.offsets[i], 0};
+        for (auto k = batch.offsets[i]; k < batch.offsets[i + 1]; ++k) {
+            auto input = batch.inputs[k];
+            auto transition = machine.transition_id(state, input);
+            if (input >= machine.n_inputs || machine.table[transition].next_state == no_transition) {
+                results[i] = {ReplayStatus::no_transition, k - batch.offsets[i], 0};
+                break;
+            }
+            const auto& entry = machine.table[transition];
+            if (batch.outputs[k] != no_transition && batch.outputs[k] != entry.output) {
+                results[i] = {ReplayStatus::output_mismatch, k - batch.offsets[i], 0};
+                break;
+            }
+            if (coverage) {
+                coverage->mark_transition(transition);
+                coverage->mark_state(entry.next_state);
+            }
+            state = entry.next_state;
+        }
+        results[i].state = state;
+    }
+}
+
+// полосы вектора: в каждой - номер последовательности, текущее состояние и позиция в общих массивах пакета;
+// векторная часть делает шаг всех активных полос, завершение и перезаполнение полос - скалярная часть
+template <int width>
+struct Lanes {
+    alignas(64) std::uint32_t state[width];
+    alignas(64) std::uint32_t position[width];
+    alignas(64) std::uint32_t end[width];
+    alignas(64) std::uint32_t active[width]; // 0 или ~0 (маска для AVX2)
+    alignas(64) std::uint32_t transition[width];
+    alignas(64) std::uint32_t next_state[width];
+    std::uint32_t sequence[width];
+
+    const CompiledMachine& machine;
+    const SequenceBatch& batch;
+    std::vector<ReplayResult>& results;
+    std::size_t next_sequence = 0;
+    std::uint32_t active_mask = 0;
+
+    Lanes(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results)
+        : machine(machine), batch(batch), results(results) {
+        for (int lane = 0; lane < width; ++lane) {
+            refill(lane);
+        }
+    }
+
+    // пустые последовательности завершаются сразу, без полосы
+    void refill(int lane) {
+        while (next_sequence < batch.size() && batch.offsets[next_sequence] == batch.offsets[next_sequence + 1]) {
+            results[next_sequence++] = {ReplayStatus::ok, 0, machine.initial_state};
+        }
+        if (next_sequence == batch.size()) {
+            active[lane] = 0;
+            position[lane] = 0;
+            active_mask &= ~(1u << lane);
+            return;
+        }
+        sequence[lane] = static_cast<std::uint32_t>(next_sequence);
+        state[lane] = machine.initial_state;
+        position[lane] = static_cast<std::uint32_t>(batch.offsets[next_sequence]);
+        end[lane] = static_cast<std::uint32_t>(batch.offsets[next_sequence + 1]);
+        active[lane] = ~0u;
+        active_mask |= 1u << lane;
+        ++next_sequence;
+    }
+
+    // полоса дошла до конца последовательности или остановилась на ошибке (причина определяется заново скалярно)
+    void finish(int lane, bool failed) {
+        auto index = sequence[lane];
+        auto offset = position[lane] - batch.offsets[index];
+        if (!failed) {
+            results[index] = {ReplayStatus::ok, offset, state[lane]};
+        } else {
+            auto input = batch.inputs[position[lane]];
+            auto missing = input >= machine.n_inputs || machine.step(state[lane], input).next_state == no_transition;
+            results[index] = {missing ? ReplayStatus::no_transition : ReplayStatus::output_mismatch, offset, state[lane]};
+        }
+        refill(lane);
+    }
+
+    // отметки покрытия для полос, сделавших шаг
+    void mark(std::uint32_t stepped, Coverage* coverage) {
+        if (!coverage) {
+            return;
+        }
+        for (; stepped; stepped &= stepped - 1) {
+            auto lane = __builtin_ctz(stepped);
+            coverage->mark_transition(transition[lane]);
+            coverage->mark_state(next_state[lane]);
+        }
+    }
+
+    void complete(std::uint32_t stepped, std::uint32_t done) {
+        for (auto failed = active_mask & ~stepped; failed; failed &= failed - 1) {
+            finish(__builtin_ctz(failed), true);
+        }
+        for (; done; done &= done - 1) {
+            finish(__builtin_ctz(done), false);
+        }
+    }
+};
+
+__attribute__((target("avx2"))) void run_avx2(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results, Coverage* coverage) {
+    Lanes<8> lanes(machine, batch, results);
+    const auto* table = reinterpret_cast<const int*>(machine.table.data());
+    const auto* inputs = reinterpret_cast<const int*>(batch.inputs.data());
+    const auto* outputs = reinterpret_cast<const int*>(batch.outputs.data());
+    const auto n_inputs = _mm256_set1_epi32(static_cast<int>(machine.n_inputs));
+    const auto none = _mm256_set1_epi32(-1);
+
+    while (lanes.active_mask) {
+        auto active = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.active));
+        auto state = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.state));
+        auto position = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.position));
+
+        auto input = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), inputs, position, active, 4);
+        auto expected = _mm256_mask_i32gather_epi32(none, outputs, position, active, 4);
+        // номера символов малы, знаковое сравнение корректно
+        auto valid = _mm256_and_si256(active, _mm256_cmpgt_epi32(n_inputs, input));
+        auto transition = _mm256_add_epi32(_mm256_mullo_epi32(state, n_inputs), input);
+        auto cell = _mm256_slli_epi32(transition, 1);
+        auto next = _mm256_mask_i32gather_epi32(none, table, cell, valid, 4);
+        auto output = _mm256_mask_i32gather_epi32(none, table + 1, cell, valid, 4);
+
+        auto output_ok = _mm256_or_si256(_mm256_cmpeq_epi32(expected, none), _mm256_cmpeq_epi32(expected, output));
+        auto stepped = _mm256_andnot_si256(_mm256_cmpeq_epi32(next, none), _mm256_and_si256(valid, output_ok));
+
+        state = _mm256_blendv_epi8(state, next, stepped);
+        position = _mm256_sub_epi32(position, stepped);
+        auto end = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.end));
+        auto done = _mm256_and_si256(stepped, _mm256_cmpeq_epi32(position, end));
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.state), state);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.position), position);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.transition), transition);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.next_state), next);
+
+        auto stepped_mask = static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(stepped)));
+        auto done_mask = static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(done)));
+        lanes.mark(stepped_mask, coverage);
+        lanes.complete(stepped_mask, done_mask);
+    }
+}
+
+__attribute__((target("avx512f"))) void run_avx512(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results, Coverage* coverage) {
+    Lanes<16> lanes(machine, batch, results);
+    const auto* table = reinterpret_cast<const int*>(machine.table.data());
+    const auto* inputs = reinterpret_cast<const int*>(batch.inputs.data());
+    const auto* outputs = reinterpret_cast<const int*>(batch.outputs.data());
+    const auto n_inputs = _mm512_set1_epi32(static_cast<int>(machine.n_inputs));
+    const auto none = _mm512_set1_epi32(-1);
+    const auto one = _mm512_set1_epi32(1);
+
+    while (lanes.active_mask) {
+        auto active = static_cast<__mmask16>(lanes.active_mask);
+        auto state = _mm512_load_si512(lanes.state);
+        auto position = _mm512_load_si512(lanes.position);
+
+        auto input = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, position, inputs, 4);
+        auto expected = _mm512_mask_i32gather_epi32(none, active, position, outputs, 4);
+        auto valid = _mm512_mask_cmplt_epu32_mask(active, input, n_inputs);
+        auto transition = _mm512_add_epi32(_mm512_mullo_epi32(state, n_inputs), input);
+        auto cell = _mm512_add_epi32(transition, transition);
+        auto next = _mm512_mask_i32gather_epi32(none, valid, cell, table, 4);
+        auto output = _mm512_mask_i32gather_epi32(none, valid, cell, table + 1, 4);
+
+        auto output_ok = _mm512_cmpeq_epi32_mask(expected, none) | _mm512_cmpeq_epi32_mask(expected, output);
+        auto stepped = _mm512_mask_cmpneq_epi32_mask(valid & output_ok, next, none);
+
+        state = _mm512_mask_mov_epi32(state, stepped, next);
+        position = _mm512_mask_add_epi32(position, stepped, position, one);
+        auto done = _mm512_mask_cmpeq_epi32_mask(stepped, position, _mm512_load_si512(lanes.end));
+
+        _mm512_store_si512(lanes.state, state);
+        _mm512_store_si512(lanes.position, position);
+        _mm512_store_si512(lanes.transition, transition);
+        _mm512_store_si512(lanes.next_state, next);
+
+        lanes.mark(stepped, coverage);
+        lanes.complete(stepped, done);
+    }
+}
+
+} // namespace
+
+void run_lanes(const CompiledMachine& machine, const SequenceBatch& batch, std::vector<ReplayResult>& results, Coverage* coverage, SimdLevel level) {
+    results.resize(batch.size());
+    if (coverage) {
+        coverage->sequences += batch.size();
+    }
+
+    // индексы сборки - знаковые 32-битные: большие таблицы и пакеты идут скалярно
+    constexpr std::size_t max_index = std::numeric_limits<std::int32_t>::max();
+    level = resolve_simd_level(level);
+    if (level == SimdLevel::scalar || machine.table.size() * 2 > max_index || batch.inputs.size() > max_index) {
+        run_scalar(machine, batch, results, coverage);
+        return;
+    }
+
+    // начальное состояние отмечается за каждую последовательность, как в replay_sequence
+    if (coverage && batch.size() > 0) {
+        coverage->states.set(machine.initial_state);
+        if (coverage->counts_hits()) {
+            coverage->state_hits[machine.initial_state] += batch.size();
+        }
+    }
+    if (level == SimdLevel::avx512) {
+        run_avx512(machine, batch, results, coverage);
+    } else {
+        run_avx2(machine, batch, results, coverage);
+    }
+}
@@ -0,0 +1,129 @@
+#include "functions.hpp"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// JSON-файлы из аргументов: каталоги раскрываются (без вложенных), файлы каталога - в порядке имен
+std::vector<std::string> collect_machine_files(const std::vector<std::string>& inputs) {
+    std::vector<std::string> files;
+    for (const auto& input : inputs) {
+        if (!fs::is_directory(input)) {
+            files.push_back(input);
+            continue;
+        }
+        std::vector<std::string> directory_files;
+        for (const auto& entry : fs::directory_iterator(input)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".json") {
+                directory_files.push_back(entry.path().string());
+            }
+        }
+        std::sort(directory_files.begin(), directory_files.end());
+        files.insert(files.end(), directory_files.begin(), directory_files.end());
+    }
+    return files;
+}
+
+// хеши канонических форм считаются в jobs потоков; при ошибке сообщается о первом по порядку файле
+std::vector<Hash128> hash_machines(const std::vector<std::string>& files, unsigned int jobs) {
+    std::vector<Hash128> hashes(files.size());
+    std::vector<std::string> errors(files.size());
+    std::atomic<std::size_t> next_file{0};
+
+    auto worker = [&]() {
+        for (auto i = next_file++; i < files.size(); i = next_file++) {
+            try {
+                auto form = canonical_form(compile_machine(json_to_machine(files[i])));
+                hashes[i] = murmur3_128(form.data(), form.size());
+            } catch (const std::exception& e) {
+                errors[i] = files[i] + ": " + e.what();
+            }
+        }
+    };
+
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs && i < files.size(); ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& error : errors) {
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+    return hashes;
+}
+
+// манифест: "<хеш> <файл> <первый файл с тем же хешем или ->", по строке на автомат
+std::size_t write_manifest(const std::string& manifest_file, const std::vector<std::string>& files, const std::vector<Hash128>& hashes) {
+    std::ofstream out(manifest_file);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open file: " + manifest_file);
+    }
+
+    std::unordered_map<std::string, std::size_t> first_file;
+    for (size_t i = 0; i < files.size(); ++i) {
+        auto hash = hashes[i].to_string();
+        auto it = first_file.emplace(hash, i).first;
+        out << hash << " " << files[i] << " " << (it->second == i ? "-" : files[it->second]) << "\n";
+    }
+    return first_file.size();
+}
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::vector<std::string> inputs;
+        std::string manifest_file;
+        unsigned int jobs = 0;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("input", po::value<std::vector<std::string>>(&inputs)->required(), "JSON description files or directories with them")("manifest", po::value<std::string>(&manifest_file), "write deduplication manifest (hash, file, first isomorphic file or -) to file")("jobs", po::value<unsigned int>(&jobs)->default_value(0), "number of hashing threads (0 - all hardware threads)")("print", "print canonical form instead of the hash");
+
+        po::positional_options_description p;
+        p.add("input", -1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        auto files = collect_machine_files(inputs);
+
+        if (vm.count("print")) {
+            for (const auto& file : files) {
+                std::cout << canonical_form(compile_machine(json_to_machine(file)));
+            }
+            return 0;
+        }
+
+        auto hashes = hash_machines(files, jobs);
+        if (!manifest_file.empty()) {
+            auto unique = write_manifest(manifest_file, files, hashes);
+            std::cout << "Machines: " << files.size() << ", unique up to state renaming: " << unique << "\n";
+        } else {
+            for (size_t i = 0; i < files.size(); ++i) {
+                std::cout << hashes[i].to_string() << "  " << files[i] << "\n";
+            }
+        }
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
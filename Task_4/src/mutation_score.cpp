@@ -0,0 +1,356 @@
+#include "functions.hpp"
+
+#include <iomanip>
+
+enum class FaultKind {
+    output,  // переход выдает другой выходной символ
+    transfer // переход ведет в другое состояние
+};
+
+// мутант: одна ошибка в одной ячейке таблицы (value - подставленный выход или следующее состояние)
+struct Mutant {
+    std::uint32_t cell;
+    FaultKind kind;
+    std::uint32_t value;
+};
+
+std::vector<Mutant> make_mutants(const CompiledMachine& machine) {
+    std::vector<Mutant> mutants;
+    for (std::uint32_t cell = 0; cell < machine.table.size(); ++cell) {
+        const auto& entry = machine.table[cell];
+        if (entry.next_state == no_transition) {
+            continue;
+        }
+        for (std::uint32_t output = 0; output < machine.output_names.size(); ++output) {
+            if (output != entry.output) {
+                mutants.push_back({cell, FaultKind::output, output});
+            }
+        }
+        for (std::uint32_t state = 0; state < machine.n_states(); ++state) {
+            if (state != entry.next_state) {
+                mutants.push_back({cell, FaultKind::transfer, state});
+            }
+        }
+    }
+    return mutants;
+}
+
+// набор тестов в памяти: входы и эталонные выходы всех последовательностей подряд,
+// плюс для каждой ячейки таблицы - последовательности, эталонный путь которых через нее проходит
+struct Suite {
+    std::vector<std::uint32_t> inputs;
+    std::vector<std::uint32_t> outputs;
+    std::vector<std::size_t> offsets = {0};
+
+    std::vector<std::size_t> cell_offsets;
+    std::vector<std::uint32_t> cell_sequences;
+
+    std::size_t size() const { return offsets.size() - 1; }
+};
+
+struct NoMarker {
+    void mark_state(std::uint32_t) {}
+    void mark_transition(std::size_t) {}
+    void mark_path(std::uint64_t) {}
+};
+
+Suite load_suite(const CompiledMachine& machine, const std::string& sequences_file) {
+    Suite suite;
+    MappedFile file(sequences_file);
+    SequenceReader reader(machine, file.begin(), file.end());
+    ParsedSequence sequence;
+    NoMarker marker;
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> visits; // (ячейка, последовательность)
+    std::vector<std::uint32_t> cells;
+    while (reader.next(sequence)) {
+        // последовательности должны быть корректны для эталонного автомата
+        auto replayed = replay_sequence(machine, sequence, nullptr, marker);
+        if (replayed.status != ReplayStatus::ok) {
+            throw std::runtime_error(replay_error_message(machine, reader, sequence, replayed));
+        }
+
+        auto index = static_cast<std::uint32_t>(suite.size());
+        auto state = machine.initial_state;
+        cells.clear();
+        for (auto input : sequence.inputs) {
+            auto cell = machine.transition_id(state, input);
+            const auto& entry = machine.table[cell];
+            suite.inputs.push_back(input);
+            suite.outputs.push_back(entry.output);
+            cells.push_back(static_cast<std::uint32_t>(cell));
+            state = entry.next_state;
+        }
+        suite.offsets.push_back(suite.inputs.size());
+
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+        for (auto cell : cells) {
+            visits.emplace_back(cell, index);
+        }
+    }
+
+    // сортировка подсчетом по ячейкам (внутри ячейки последовательности уже упорядочены)
+    suite.cell_offsets.assign(machine.table.size() + 1, 0);
+    for (const auto& visit : visits) {
+        suite.cell_offsets[visit.first + 1]++;
+    }
+    for (size_t cell = 0; cell < machine.table.size(); ++cell) {
+        suite.cell_offsets[cell + 1] += suite.cell_offsets[cell];
+    }
+    suite.cell_sequences.resize(visits.size());
+    auto position = suite.cell_offsets;
+    for (const auto& visit : visits) {
+        suite.cell_sequences[position[visit.first]++] = visit.second;
+    }
+    return suite;
+}
+
+// ошибки группы мутантов в одной ячейке таблицы (bit - маска мутанта в слове группы)
+struct CellFaults {
+    std::uint32_t cell;
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> outputs;
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> transfers;
+};
+
+// побитово-параллельная симуляция группы из 64 мутантов: words[s] - маска мутантов группы, находящихся в состоянии s.
+// Пока мутант не свернул с эталонного пути, он идет вместе с эталоном в общем слове; ошибочные ячейки
+// обрабатываются только для затронутых битов, а переход в отсутствующую ячейку считается обнаружением мутанта
+class GroupSimulator {
+  public:
+    explicit GroupSimulator(const CompiledMachine& machine)
+        : machine(machine), words(machine.n_states(), 0), next_words(machine.n_states(), 0), slots(machine.table.size(), -1) {}
+
+    std::uint64_t run(const Suite& suite, const Mutant* mutants, std::size_t count) {
+        faults.clear();
+        for (size_t i = 0; i < count; ++i) {
+            const auto& mutant = mutants[i];
+            if (faults.empty() || faults.back().cell != mutant.cell) {
+                faults.push_back({mutant.cell, {}, {}});
+            }
+            auto bit = std::uint64_t{1} << i;
+            if (mutant.kind == FaultKind::output) {
+                faults.back().outputs.emplace_back(bit, mutant.value);
+            } else {
+                faults.back().transfers.emplace_back(bit, mutant.value);
+            }
+        }
+
+        // мутанты группы могут свернуть с эталона только в последовательностях, проходящих через их ячейки
+        sequences.clear();
+        for (size_t i = 0; i < faults.size(); ++i) {
+            slots[faults[i].cell] = static_cast<std::int32_t>(i);
+            auto cell = faults[i].cell;
+            sequences.insert(sequences.end(), suite.cell_sequences.begin() + suite.cell_offsets[cell],
+                suite.cell_sequences.begin() + suite.cell_offsets[cell + 1]);
+        }
+        std::sort(sequences.begin(), sequences.end());
+        sequences.erase(std::unique(sequences.begin(), sequences.end()), sequences.end());
+
+        auto all = count == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << count) - 1;
+        std::uint64_t killed = 0;
+        for (auto index : sequences) {
+            if (killed == all) {
+                break;
+            }
+            killed |= run_sequence(suite, index, all & ~killed);
+        }
+
+        for (const auto& fault : faults) {
+            slots[fault.cell] = -1;
+        }
+        return killed;
+    }
+
+  private:
+    std::uint64_t run_sequence(const Suite& suite, std::size_t index, std::uint64_t alive) {
+        std::uint64_t killed = 0;
+        words[machine.initial_state] = alive;
+        occupied.assign(1, machine.initial_state);
+
+        for (auto k = suite.offsets[index]; k < suite.offsets[index + 1] && !occupied.empty(); ++k) {
+            auto input = suite.inputs[k];
+            auto expected = suite.outputs[k];
+            next_occupied.clear();
+
+            for (auto state : occupied) {
+                auto mask = words[state];
+                words[state] = 0;
+
+                auto cell = machine.transition_id(state, input);
+                const auto& entry = machine.table[cell];
+                if (entry.next_state == no_transition) {
+                    killed |= mask;
+                    continue;
+                }
+
+                auto slot = slots[cell];
+                if (slot >= 0) {
+                    const auto& fault = faults[slot];
+                    for (const auto& [bit, output] : fault.outputs) {
+                        if (mask & bit) {
+                            mask &= ~bit;
+                            if (output != expected) {
+                                killed |= bit;
+                            } else {
+                                move(entry.next_state, bit);
+                            }
+                        }
+                    }
+                    if (entry.output != expected) {
+                        killed |= mask;
+                        continue;
+                    }
+                    for (const auto& [bit, state_to] : fault.transfers) {
+                        if (mask & bit) {
+                            mask &= ~bit;
+                            move(state_to, bit);
+                        }
+                    }
+                } else if (entry.output != expected) {
+                    killed |= mask;
+                    continue;
+                }
+                move(entry.next_state, mask);
+            }
+
+            std::swap(words, next_words);
+            std::swap(occupied, next_occupied);
+        }
+
+        for (auto state : occupied) {
+            words[state] = 0;
+        }
+        return killed;
+    }
+
+    void move(std::uint32_t state, std::uint64_t mask) {
+        if (mask == 0) {
+            return;
+        }
+        if (next_words[state] == 0) {
+            next_occupied.push_back(state);
+        }
+        next_words[state] |= mask;
+    }
+
+    const CompiledMachine& machine;
+    std::vector<std::uint64_t> words;
+    std::vector<std::uint64_t> next_words;
+    std::vector<std::uint32_t> occupied;
+    std::vector<std::uint32_t> next_occupied;
+    std::vector<std::int32_t> slots; // номер CellFaults для ячейки или -1
+    std::vector<CellFaults> faults;
+    std::vector<std::uint32_t> sequences;
+};
+
+// группы по 64 мутанта раздаются потокам через общий счетчик; маска убитых мутантов группы пишется одним потоком
+std::vector<std::uint64_t> simulate_mutants(const CompiledMachine& machine, const Suite& suite, const std::vector<Mutant>& mutants, unsigned int jobs) {
+    auto n_groups = (mutants.size() + 63) / 64;
+    std::vector<std::uint64_t> killed(n_groups, 0);
+    std::atomic<std::size_t> next_group{0};
+
+    auto worker = [&]() {
+        GroupSimulator simulator(machine);
+        for (auto group = next_group++; group < n_groups; group = next_group++) {
+            auto first = group * 64;
+            auto count = std::min<std::size_t>(64, mutants.size() - first);
+            killed[group] = simulator.run(suite, mutants.data() + first, count);
+        }
+    };
+
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned int>(std::min<std::size_t>(jobs, std::max<std::size_t>(1, n_groups)));
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return killed;
+}
+
+std::string mutant_to_string(const CompiledMachine& machine, const Mutant& mutant) {
+    if (mutant.kind == FaultKind::output) {
+        return "output fault " + transition_to_string(machine, mutant.cell) + " gives " + machine.output_names[mutant.value];
+    }
+    return "transfer fault " + transition_to_string(machine, mutant.cell) + " goes to " + machine.state_names[mutant.value];
+}
+
+void print_score(std::ostream& out, const std::string& name, std::size_t killed, std::size_t total) {
+    out << name << ": killed " << killed << " of " << total;
+    if (total > 0) {
+        out << " (" << std::fixed << std::setprecision(2) << 100.0 * killed / total << "%)";
+    }
+    out << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::string json_description;
+        std::string sequences_file;
+        std::string survivors_file;
+        unsigned int jobs = 1;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("json-description", po::value<std::string>(&json_description)->required(), "JSON description file path")("seq", po::value<std::string>(&sequences_file)->required(), "sequence file to score")("jobs", po::value<unsigned int>(&jobs)->default_value(1), "number of simulation threads (0 - all hardware threads)")("survivors", po::value<std::string>(&survivors_file), "write mutants not detected by the sequences to this file");
+
+        po::positional_options_description p;
+        p.add("json-description", 1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        auto compiled_machine = compile_machine(json_to_machine(json_description));
+        auto suite = load_suite(compiled_machine, sequences_file);
+        auto mutants = make_mutants(compiled_machine);
+        auto killed = simulate_mutants(compiled_machine, suite, mutants, jobs);
+
+        std::size_t output_total = 0, output_killed = 0;
+        std::size_t transfer_total = 0, transfer_killed = 0;
+        std::ofstream survivors;
+        if (!survivors_file.empty()) {
+            survivors.open(survivors_file);
+            if (!survivors.is_open()) {
+                throw std::runtime_error("Failed to open file: " + survivors_file);
+            }
+        }
+        for (size_t i = 0; i < mutants.size(); ++i) {
+            auto is_killed = (killed[i / 64] >> (i % 64)) & 1;
+            if (mutants[i].kind == FaultKind::output) {
+                output_total++;
+                output_killed += is_killed;
+            } else {
+                transfer_total++;
+                transfer_killed += is_killed;
+            }
+            if (!is_killed && survivors.is_open()) {
+                survivors << mutant_to_string(compiled_machine, mutants[i]) << "\n";
+            }
+        }
+
+        print_score(std::cout, "Output faults", output_killed, output_total);
+        print_score(std::cout, "Transfer faults", transfer_killed, transfer_total);
+        print_score(std::cout, "Total", output_killed + transfer_killed, mutants.size());
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,217 @@
+#include "functions.hpp"
+
+#include <queue>
+
+// элементы покрытия одной последовательности собираются в общий плоский массив (смещения по последовательностям)
+struct SequenceElements {
+    std::vector<std::uint32_t> elements;
+    std::vector<std::size_t> offsets = {0};
+    std::vector<std::size_t> lines;
+    std::vector<std::size_t> lengths;
+
+    std::size_t size() const { return lines.size(); }
+};
+
+// отметчик для replay_sequence: переводит состояния, переходы или хеши путей в плотные номера элементов
+class ElementCollector {
+  public:
+    ElementCollector(const std::string& criterion, std::vector<std::uint32_t>& elements)
+        : criterion(criterion), elements(elements) {}
+
+    void mark_state(std::uint32_t state) {
+        if (criterion == "states") {
+            elements.push_back(state);
+        }
+    }
+    void mark_transition(std::size_t transition) {
+        if (criterion == "transitions") {
+            elements.push_back(static_cast<std::uint32_t>(transition));
+        }
+    }
+    void mark_path(std::uint64_t hash) {
+        auto it = path_ids.emplace(hash, static_cast<std::uint32_t>(path_ids.size())).first;
+        elements.push_back(it->second);
+    }
+
+    std::size_t n_paths() const { return path_ids.size(); }
+
+  private:
+    std::string criterion;
+    std::vector<std::uint32_t>& elements;
+    std::unordered_map<std::uint64_t, std::uint32_t> path_ids;
+};
+
+SequenceElements collect_elements(const CompiledMachine& machine, const MappedFile& file, const std::string& criterion, std::uint32_t path_len, std::size_t& n_elements) {
+    SequenceElements result;
+    ElementCollector collector(criterion, result.elements);
+
+    PathWindow window;
+    if (criterion == "paths") {
+        window = PathWindow(machine, effective_path_len(machine, path_len));
+    }
+
+    SequenceReader reader(machine, file.begin(), file.end());
+    ParsedSequence sequence;
+    while (reader.next(sequence)) {
+        auto replayed = replay_sequence(machine, sequence, window.path_len > 0 ? &window : nullptr, collector);
+        if (replayed.status != ReplayStatus::ok) {
+            throw std::runtime_error(replay_error_message(machine, reader, sequence, replayed));
+        }
+
+        // повторные элементы внутри последовательности не нужны
+        auto first = result.elements.begin() + result.offsets.back();
+        std::sort(first, result.elements.end());
+        result.elements.erase(std::unique(first, result.elements.end()), result.elements.end());
+
+        result.offsets.push_back(result.elements.size());
+        result.lines.push_back(sequence.line);
+        result.lengths.push_back(sequence.inputs.size());
+    }
+
+    if (criterion == "states") {
+        n_elements = machine.n_states();
+    } else if (criterion == "transitions") {
+        n_elements = machine.table.size();
+    } else {
+        n_elements = collector.n_paths();
+    }
+    return result;
+}
+
+// ленивый жадный алгоритм покрытия множества: оценки в очереди только убывают, поэтому
+// достаточно пересчитать выигрыш вершины и взять ее, если она по-прежнему не хуже следующей
+std::vector<std::size_t> lazy_greedy_cover(const SequenceElements& sequences, std::size_t n_elements, bool weight_by_length) {
+    struct Candidate {
+        double score;
+        std::size_t gain;
+        std::size_t index;
+
+        bool operator<(const Candidate& other) const {
+            if (score != other.score) {
+                return score < other.score;
+            }
+            return index > other.index; // при равенстве - более ранняя последовательность
+        }
+    };
+
+    auto cost = [&](std::size_t index) {
+        return weight_by_length ? static_cast<double>(std::max<std::size_t>(1, sequences.lengths[index])) : 1.0;
+    };
+
+    std::priority_queue<Candidate> queue;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        auto gain = sequences.offsets[i + 1] - sequences.offsets[i];
+        if (gain > 0) {
+            queue.push({gain / cost(i), gain, i});
+        }
+    }
+
+    Bitset covered(n_elements);
+    std::vector<std::size_t> selected;
+    while (!queue.empty()) {
+        auto top = queue.top();
+        queue.pop();
+
+        std::size_t gain = 0;
+        for (auto k = sequences.offsets[top.index]; k < sequences.offsets[top.index + 1]; ++k) {
+            gain += !covered.test(sequences.elements[k]);
+        }
+        if (gain == 0) {
+            continue;
+        }
+
+        if (gain != top.gain) {
+            queue.push({gain / cost(top.index), gain, top.index});
+            continue;
+        }
+
+        selected.push_back(top.index);
+        for (auto k = sequences.offsets[top.index]; k < sequences.offsets[top.index + 1]; ++k) {
+            covered.set(sequences.elements[k]);
+        }
+    }
+
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+// второй проход по отображенному файлу: копирование выбранных строк без изменений
+void write_selected_lines(const MappedFile& file, const SequenceElements& sequences, const std::vector<std::size_t>& selected, const std::string& output_file) {
+    std::ofstream out(output_file);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open file: " + output_file);
+    }
+
+    auto current = file.begin();
+    std::size_t line = 1;
+    for (auto index : selected) {
+        auto target = sequences.lines[index];
+        for (; line < target; ++line) {
+            current = static_cast<const char*>(std::memchr(current, '\n', file.end() - current)) + 1;
+        }
+        auto newline = static_cast<const char*>(std::memchr(current, '\n', file.end() - current));
+        auto line_end = newline ? newline : file.end();
+        out.write(current, line_end - current);
+        out << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+
+        std::string criterion;
+        unsigned int path_len = 0;
+        std::string json_description;
+        std::string sequences_file;
+        std::string output_file;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()("help", "produce help message")("criterion", po::value<std::string>(&criterion)->default_value("transitions"), "preserved coverage (states/transitions/paths)")("path-len", po::value<unsigned int>(&path_len), "length of the path for paths criterion")("json-description", po::value<std::string>(&json_description)->required(), "JSON description file path")("seq", po::value<std::string>(&sequences_file)->required(), "sequence file to minimize")("out", po::value<std::string>(&output_file)->required(), "output file for the minimized suite")("weight-by-length", "prefer short sequences (greedy by new elements per input symbol)");
+
+        po::positional_options_description p;
+        p.add("json-description", 1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 0;
+        }
+
+        po::notify(vm);
+
+        if (criterion != "states" && criterion != "transitions" && criterion != "paths") {
+            throw std::invalid_argument("Invalid criterion: " + criterion + ". There're only 3 criteria: states/transitions/paths");
+        }
+        if (criterion == "paths" && path_len <= 0) {
+            throw std::invalid_argument("Path length must be positive for paths criterion");
+        }
+
+        auto compiled_machine = compile_machine(json_to_machine(json_description));
+        MappedFile file(sequences_file);
+
+        std::size_t n_elements = 0;
+        auto sequences = collect_elements(compiled_machine, file, criterion, path_len, n_elements);
+        auto selected = lazy_greedy_cover(sequences, n_elements, vm.count("weight-by-length") > 0);
+        write_selected_lines(file, sequences, selected, output_file);
+
+        std::size_t total_length = 0;
+        std::size_t kept_length = 0;
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            total_length += sequences.lengths[i];
+        }
+        for (auto index : selected) {
+            kept_length += sequences.lengths[index];
+        }
+        std::cout << "Kept " << selected.size() << " of " << sequences.size() << " sequences ("
+                  << kept_length << " of " << total_length << " input symbols)\n";
+
+    } catch (const po::error& e) {
+        std::cerr << "Command line error: " << e.what() << "\n";
+        return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,404 @@
+#include "transition_store.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+std::vector<std::string> read_lines(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// отображение файла только для чтения; пустой файл - nullptr
+const void* map_readonly(const std::string& path, std::size_t& length, int advice) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat file: " + path);
+    }
+    length = static_cast<std::size_t>(file_stat.st_size);
+    void* region = nullptr;
+    if (length > 0) {
+        region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (region == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        madvise(region, length, advice);
+    }
+    close(fd);
+    return region;
+}
+
+std::FILE* open_file(const std::string& path, const char* mode) {
+    auto file = std::fopen(path.c_str(), mode);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    return file;
+}
+
+void write_all(std::FILE* file, const void* data, std::size_t bytes) {
+    if (bytes > 0 && std::fwrite(data, 1, bytes, file) != bytes) {
+        throw std::runtime_error("Failed to write transition store");
+    }
+}
+
+} // namespace
+
+TemporaryDirectory::TemporaryDirectory(const std::string& parent) {
+    std::string pattern = parent + "/fsm_tmp_XXXXXX";
+    if (mkdtemp(&pattern[0]) == nullptr) {
+        throw std::runtime_error("Failed to create temporary directory in: " + parent);
+    }
+    directory = pattern;
+}
+
+TemporaryDirectory::~TemporaryDirectory() {
+    if (auto* dir = opendir(directory.c_str())) {
+        while (auto* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                std::remove(path(name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory.c_str());
+}
+
+MappedArrayFile::MappedArrayFile(const std::string& path, std::size_t bytes) : length(std::max<std::size_t>(bytes, 1)) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to resize file: " + path);
+    }
+    region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + path);
+    }
+}
+
+MappedArrayFile::~MappedArrayFile() {
+    munmap(region, length);
+}
+
+DiskBitset::DiskBitset(const std::string& path, std::uint64_t size)
+    : file(path, (size + 63) / 64 * sizeof(std::uint64_t)), words(static_cast<std::uint64_t*>(file.data())), bits(size) {}
+
+TransitionStore::TransitionStore(const std::string& directory) : directory(directory) {
+    std::unordered_map<std::string, std::uint64_t> meta;
+    for (const auto& line : read_lines(directory + "/meta.txt")) {
+        auto space = line.find(' ');
+        if (space != std::string::npos) {
+            meta[line.substr(0, space)] = std::stoull(line.substr(space + 1));
+        }
+    }
+    for (const auto* key : {"n_states", "n_inputs", "initial_state", "shard_states"}) {
+        if (!meta.count(key)) {
+            throw std::runtime_error("Transition store " + directory + " has no " + key + " in meta.txt");
+        }
+    }
+    states = static_cast<std::uint32_t>(meta["n_states"]);
+    inputs = static_cast<std::uint32_t>(meta["n_inputs"]);
+    initial = static_cast<std::uint32_t>(meta["initial_state"]);
+    per_shard = std::max<std::uint32_t>(1, static_cast<std::uint32_t>(meta["shard_states"]));
+
+    input_list = read_lines(directory + "/inputs.txt");
+    output_list = read_lines(directory + "/outputs.txt");
+    if (input_list.size() != inputs) {
+        throw std::runtime_error("Transition store " + directory + ": inputs.txt does not match meta.txt");
+    }
+
+    names = static_cast<const char*>(map_readonly(directory + "/states.txt", names_length, MADV_RANDOM));
+    name_offsets = static_cast<const std::uint64_t*>(map_readonly(directory + "/states.idx", offsets_length, MADV_RANDOM));
+    if (offsets_length != (static_cast<std::size_t>(states) + 1) * sizeof(std::uint64_t)) {
+        throw std::runtime_error("Transition store " + directory + ": states.idx does not match meta.txt");
+    }
+    mapped_shards.assign(n_shards(), nullptr);
+}
+
+TransitionStore::~TransitionStore() {
+    if (names) {
+        munmap(const_cast<char*>(names), names_length);
+    }
+    if (name_offsets) {
+        munmap(const_cast<std::uint64_t*>(name_offsets), offsets_length);
+    }
+    for (std::uint32_t shard = 0; shard < mapped_shards.size(); ++shard) {
+        if (mapped_shards[shard]) {
+            auto first = static_cast<std::size_t>(shard) * per_shard;
+            auto rows = std::min<std::size_t>(per_shard, states - first);
+            munmap(const_cast<TableEntry*>(mapped_shards[shard]), rows * inputs * sizeof(TableEntry));
+        }
+    }
+}
+
+std::string TransitionStore::state_name(std::uint32_t state) const {
+    // в states.txt имена разделены переводом строки, который в имя не входит
+    return std::string(names + name_offsets[state], name_offsets[state + 1] - name_offsets[state] - 1);
+}
+
+std::string TransitionStore::shard_path(std::uint32_t shard) const {
+    return directory + "/shard_" + std::to_string(shard) + ".bin";
+}
+
+const TableEntry& TransitionStore::step(std::uint32_t state, std::uint32_t input) const {
+    auto shard = shard_of(state);
+    if (!mapped_shards[shard]) {
+        std::size_t length = 0;
+        mapped_shards[shard] = static_cast<const TableEntry*>(map_readonly(shard_path(shard), length, MADV_RANDOM));
+    }
+    return mapped_shards[shard][static_cast<std::size_t>(state - shard * per_shard) * inputs + input];
+}
+
+void TransitionStore::load_shard(std::uint32_t shard, std::vector<TableEntry>& buffer) const {
+    auto first = static_cast<std::size_t>(shard) * per_shard;
+    buffer.resize(std::min<std::size_t>(per_shard, states - first) * inputs);
+
+    int fd = open(shard_path(shard).c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + shard_path(shard));
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    auto bytes = buffer.size() * sizeof(TableEntry);
+    auto* data = reinterpret_cast<char*>(buffer.data());
+    for (std::size_t done = 0; done < bytes;) {
+        auto n = read(fd, data + done, bytes - done);
+        if (n <= 0) {
+            close(fd);
+            throw std::runtime_error("Failed to read file: " + shard_path(shard));
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    close(fd);
+}
+
+void TransitionStore::prefetch_shard(std::uint32_t shard) const {
+    int fd = open(shard_path(shard).c_str(), O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+TransitionStoreWriter::TransitionStoreWriter(const std::string& directory, std::uint32_t shard_states, const std::vector<std::string>& input_names, const std::vector<std::string>& output_names)
+    : directory(directory), per_shard(std::max<std::uint32_t>(1, shard_states)), inputs(static_cast<std::uint32_t>(input_names.size())) {
+    mkdir(directory.c_str(), 0755);
+
+    write_symbols("/inputs.txt", input_names);
+    write_symbols("/outputs.txt", output_names);
+
+    names = open_file(directory + "/states.txt", "wb");
+    offsets = open_file(directory + "/states.idx", "wb");
+    write_all(offsets, &names_offset, sizeof(names_offset));
+}
+
+TransitionStoreWriter::~TransitionStoreWriter() {
+    for (auto* file : {shard, names, offsets}) {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+}
+
+void TransitionStoreWriter::set_output_names(const std::vector<std::string>& output_names) {
+    write_symbols("/outputs.txt", output_names);
+}
+
+void TransitionStoreWriter::write_symbols(const std::string& file_name, const std::vector<std::string>& symbols) {
+    std::ofstream out(directory + file_name);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open file: " + directory + file_name);
+    }
+    for (const auto& symbol : symbols) {
+        out << symbol << "\n";
+    }
+}
+
+void TransitionStoreWriter::add_state(const std::string& name, const TableEntry* row) {
+    if (states % per_shard == 0) {
+        if (shard) {
+            std::fclose(shard);
+        }
+        shard = open_file(directory + "/shard_" + std::to_string(states / per_shard) + ".bin", "wb");
+    }
+    write_all(shard, row, static_cast<std::size_t>(inputs) * sizeof(TableEntry));
+
+    write_all(names, name.data(), name.size());
+    write_all(names, "\n", 1);
+    names_offset += name.size() + 1;
+    write_all(offsets, &names_offset, sizeof(names_offset));
+    states++;
+}
+
+void TransitionStoreWriter::finish(std::uint32_t initial_state) {
+    for (auto** file : {&shard, &names, &offsets}) {
+        if (*file) {
+            std::fclose(*file);
+            *file = nullptr;
+        }
+    }
+
+    std::ofstream meta(directory + "/meta.txt");
+    if (!meta.is_open()) {
+        throw std::runtime_error("Failed to open file: " + directory + "/meta.txt");
+    }
+    meta << "n_states " << states << "\n"
+         << "n_inputs " << inputs << "\n"
+         << "initial_state " << initial_state << "\n"
+         << "shard_states " << per_shard << "\n";
+}
+
+namespace {
+
+struct BfsRecord {
+    std::uint32_t state;
+    std::uint32_t parent;
+    std::uint32_t input;
+};
+
+// корзины кандидатов одного уровня: по файлу на шард, записи копятся в небольших буферах
+class BfsBuckets {
+  public:
+    BfsBuckets(const std::string& prefix, std::uint32_t n_shards) : prefix(prefix), buffers(n_shards), sizes(n_shards, 0) {}
+
+    void add(std::uint32_t shard, const BfsRecord& record) {
+        auto& buffer = buffers[shard];
+        buffer.push_back(record);
+        if (buffer.size() == buffer_records) {
+            flush(shard);
+        }
+    }
+
+    void flush_all() {
+        for (std::uint32_t shard = 0; shard < buffers.size(); ++shard) {
+            flush(shard);
+        }
+    }
+
+    bool empty(std::uint32_t shard) const { return sizes[shard] == 0; }
+
+    // чтение корзины шарда частями с последующим удалением файла
+    void drain(std::uint32_t shard, const std::function<void(const BfsRecord&)>& visit) {
+        if (sizes[shard] == 0) {
+            return;
+        }
+        auto file = open_file(path(shard), "rb");
+        std::vector<BfsRecord> chunk(buffer_records);
+        for (std::size_t n; (n = std::fread(chunk.data(), sizeof(BfsRecord), chunk.size(), file)) > 0;) {
+            for (std::size_t i = 0; i < n; ++i) {
+                visit(chunk[i]);
+            }
+        }
+        std::fclose(file);
+        std::remove(path(shard).c_str());
+        sizes[shard] = 0;
+    }
+
+  private:
+    static constexpr std::size_t buffer_records = 1024;
+
+    std::string path(std::uint32_t shard) const { return prefix + std::to_string(shard) + ".bin"; }
+
+    void flush(std::uint32_t shard) {
+        auto& buffer = buffers[shard];
+        if (buffer.empty()) {
+            return;
+        }
+        auto file = open_file(path(shard), "ab");
+        write_all(file, buffer.data(), buffer.size() * sizeof(BfsRecord));
+        std::fclose(file);
+        sizes[shard] += buffer.size();
+        buffer.clear();
+    }
+
+    std::string prefix;
+    std::vector<std::vector<BfsRecord>> buffers;
+    std::vector<std::uint64_t> sizes;
+};
+
+} // namespace
+
+std::uint64_t external_bfs(const TransitionStore& store, const std::string& work_dir,
+    const std::function<void(std::uint32_t, std::uint32_t, std::uint32_t)>& on_discover) {
+    TemporaryDirectory temporary(work_dir);
+    DiskBitset visited(temporary.path("bfs_visited.bits"), store.n_states());
+    BfsBuckets current(temporary.path("bfs_a_"), store.n_shards());
+    BfsBuckets next(temporary.path("bfs_b_"), store.n_shards());
+
+    std::uint64_t reached = 0;
+    std::vector<TableEntry> rows;
+    std::vector<std::uint32_t> frontier;
+
+    current.add(store.shard_of(store.initial_state()), {store.initial_state(), no_transition, no_transition});
+    current.flush_all();
+
+    for (auto level_empty = false; !level_empty; std::swap(current, next)) {
+        level_empty = true;
+        for (std::uint32_t shard = 0; shard < store.n_shards(); ++shard) {
+            if (current.empty(shard)) {
+                continue;
+            }
+            level_empty = false;
+            for (auto ahead = shard + 1; ahead < store.n_shards(); ++ahead) {
+                if (!current.empty(ahead)) {
+                    store.prefetch_shard(ahead);
+                    break;
+                }
+            }
+
+            frontier.clear();
+            current.drain(shard, [&](const BfsRecord& record) {
+                if (!visited.test(record.state)) {
+                    visited.set(record.state);
+                    on_discover(record.state, record.parent, record.input);
+                    frontier.push_back(record.state);
+                }
+            });
+            if (frontier.empty()) {
+                continue;
+            }
+            reached += frontier.size();
+
+            store.load_shard(shard, rows);
+            auto first = shard * store.shard_states();
+            for (auto state : frontier) {
+                for (std::uint32_t input = 0; input < store.n_inputs(); ++input) {
+                    const auto& entry = rows[static_cast<std::size_t>(state - first) * store.n_inputs() + input];
+                    if (entry.next_state != no_transition && !visited.test(entry.next_state)) {
+                        next.add(store.shard_of(entry.next_state), {entry.next_state, state, input});
+                    }
+                }
+            }
+        }
+        next.flush_all();
+    }
+
+    return reached;
+}
@@ -22,11 +22,15 @@ mkdir -p "$output_dir/jsons"
 mkdir -p "$output_dir/DOTs"
 mkdir -p "$output_dir/imgs"
 mkdir -p "$output_dir/sequences"
+mkdir -p "$output_dir/stores"
 
 generate_seed() {
     echo $RANDOM
 }
 
+# канонические хеши уже проверенных автоматов: изоморфные (с точностью до имен состояний) не проверяются повторно
+declare -A checked_machines
+
 for ((i=0; i<num_runs; i++)); do
     seed=$(generate_seed)
     json_file="${output_dir}/jsons/${seed}.json"
@@ -41,6 +45,18 @@ for ((i=0; i<num_runs; i++)); do
         exit 1
     fi
 
+    machine_hash=$(./build/machine_canon "$json_file" | cut -d' ' -f1)
+    if [ -z "$machine_hash" ]; then
+        echo "Error hashing machine with seed $seed"
+        exit 1
+    fi
+    if [ -n "${checked_machines[$machine_hash]}" ]; then
+        echo "  isomorphic to ${checked_machines[$machine_hash]}, skipping"
+        echo "----------"
+        continue
+    fi
+    checked_machines[$machine_hash]="$json_file"
+
     echo "Generating DOT file..."
     ../Task_1/build/converter --input="$json_file" --output="$dot_file"
     if [ $? -ne 0 ]; then
@@ -56,27 +72,12 @@ for ((i=0; i<num_runs; i++)); do
     fi
 
     echo "Generating sequences for coverage checking..."
-    ../Task_3/build/sequence_formation --mode=states --out="${seq_file}_s.txt" "$json_file"
+    # все три режима за один разбор автомата: ${seq_file}_s.txt, ${seq_file}_t.txt, ${seq_file}_p.txt
+    ../Task_3/build/sequence_formation --mode="states,transitions,paths:$path_len" --with-outputs --out="${seq_file}" "$json_file"
     if [ $? -eq 0 ]; then
-        echo "  for states mode: generated"
+        echo "  for states, transitions, paths modes: generated"
     else
-        echo "Error generating sequences for states mode"
-        exit 1
-    fi
-
-    ../Task_3/build/sequence_formation --mode=transitions --out="${seq_file}_t.txt" "$json_file"
-    if [ $? -eq 0 ]; then
-        echo "  for transitions mode: generated"
-    else
-        echo "Error generating sequences for transitions mode"
-        exit 1
-    fi
-
-    ../Task_3/build/sequence_formation --mode=paths --path-len="$path_len" --out="${seq_file}_p.txt" "$json_file"
-    if [ $? -eq 0 ]; then
-        echo "  for paths mode: generated"
-    else
-        echo "Error generating sequences for paths mode"
+        echo "Error generating sequences"
         exit 1
     fi
 
@@ -105,8 +106,156 @@ for ((i=0; i<num_runs; i++)); do
         exit 1
     fi
 
+    ./build/coverage_checking --mode conformance --seq "${seq_file}_t.txt" "$json_file"
+    if [ $? -eq 0 ]; then
+        echo "  for conformance mode: outputs match"
+    else
+        echo "Conformance check failed"
+        exit 1
+    fi
+
+    echo "Checking coverage through --serve..."
+    # те же проверки одним процессом: автомат компилируется один раз, ответы - "<номер> ok|error <число строк>";
+    # последний запрос ссылается на несуществующий файл, его ответ должен быть error, а остальные ответы - не пострадать
+    responses=$(./build/coverage_checking --serve <<EOF
+--mode states --seq "${seq_file}_s.txt" "$json_file"
+--mode transitions --seq "${seq_file}_t.txt" "$json_file"
+--mode paths --path-len "$path_len" --seq "${seq_file}_p.txt" "$json_file"
+--mode conformance --seq "${seq_file}_t.txt" "$json_file"
+--mode transitions --seq "${seq_file}_missing.txt" "$json_file"
+EOF
+)
+    if [ $? -eq 0 ] && [ "$(echo "$responses" | grep -c '^[1-4] ok ')" -eq 4 ] && echo "$responses" | grep -q '^5 error '; then
+        echo "  for states, transitions, paths, conformance modes: same results"
+    else
+        echo "Coverage check through --serve failed:"
+        echo "$responses"
+        exit 1
+    fi
+
+    echo "Checking completion of an empty suite..."
+    # пустой набор: карта покрытия без единой последовательности, дополнение должно само покрыть весь автомат
+    : > "${seq_file}_empty.txt"
+    for mode in states transitions; do
+        ./build/coverage_checking --mode $mode --seq "${seq_file}_empty.txt" --coverage-out "${seq_file}_empty.map" "$json_file" > /dev/null 2>&1
+        timeout 60 ./build/coverage_checking --mode $mode --coverage-in "${seq_file}_empty.map" --complete "${seq_file}_top.txt" "$json_file" > /dev/null 2>&1
+        if [ $? -eq 124 ] || ! ./build/coverage_checking --mode $mode --seq "${seq_file}_top.txt" "$json_file" > /dev/null; then
+            echo "Completion of an empty suite failed in $mode mode"
+            exit 1
+        fi
+    done
+    echo "  for states, transitions modes: completed"
+
+    echo "Checking suite minimization..."
+    ./build/suite_minimize --criterion transitions --seq "${seq_file}_t.txt" --out "${seq_file}_min.txt" "$json_file" > /dev/null &&
+        ./build/coverage_checking --mode transitions --seq "${seq_file}_min.txt" "$json_file" > /dev/null
+    if [ $? -eq 0 ]; then
+        echo "  minimized suite: transitions coveraged"
+    else
+        echo "Minimized suite does not cover transitions"
+        exit 1
+    fi
+
+    echo "Checking mutation score..."
+    # набор, покрывающий все переходы с выходами, убивает каждого мутанта выхода
+    score=$(./build/mutation_score --seq "${seq_file}_t.txt" "$json_file")
+    if [ $? -eq 0 ] && echo "$score" | grep -Eq '^Output faults: killed ([0-9]+) of \1( |$)'; then
+        echo "  all output faults killed"
+    else
+        echo "Mutation score check failed:"
+        echo "$score"
+        exit 1
+    fi
+
+    echo "Checking equivalence..."
+    # копия с переименованными состояниями эквивалентна (код 0), копия с измененными выходами - нет (код 1),
+    # если из начального состояния есть хотя бы один переход
+    renamed_file="${output_dir}/jsons/${seed}_renamed.json"
+    changed_file="${output_dir}/jsons/${seed}_changed.json"
+    sed 's/"q\([0-9]*\)"/"renamed_q\1"/g' "$json_file" > "$renamed_file"
+    sed 's/"output": "\([^"]*\)"/"output": "changed_\1"/g' "$json_file" > "$changed_file"
+    expected_code=0
+    if [ -n "$(head -c 1 "${seq_file}_t.txt")" ]; then
+        expected_code=1
+    fi
+    ./build/fsm_equiv "$json_file" "$renamed_file" > /dev/null
+    renamed_code=$?
+    ./build/fsm_equiv "$json_file" "$changed_file" > /dev/null 2>&1
+    changed_code=$?
+    if [ $renamed_code -eq 0 ] && [ $changed_code -eq $expected_code ]; then
+        echo "  renamed copy: equivalent, changed outputs: exit code $changed_code"
+    else
+        echo "Equivalence check failed: renamed copy exit code $renamed_code, changed outputs exit code $changed_code"
+        exit 1
+    fi
+
+    echo "Checking the external-memory store..."
+    # проверка по хранилищу должна давать те же сообщения и коды, что и проверка в памяти, в том числе на неполном наборе
+    store_dir="${output_dir}/stores/${seed}"
+    rm -rf "$store_dir"
+    ./build/fsm_store --out "$store_dir" "$json_file"
+    head -n 1 "${seq_file}_t.txt" > "${seq_file}_part.txt"
+    for mode in states transitions; do
+        for seq in "${seq_file}_${mode:0:1}.txt" "${seq_file}_part.txt"; do
+            in_memory=$(./build/coverage_checking --mode $mode --seq "$seq" "$json_file" 2>&1; echo "exit code $?")
+            in_store=$(./build/coverage_checking --mode $mode --seq "$seq" --store "$store_dir" 2>&1; echo "exit code $?")
+            if [ "$in_memory" != "$in_store" ]; then
+                echo "Store check differs from the in-memory check in $mode mode for $seq:"
+                echo "$in_memory"
+                echo "$in_store"
+                exit 1
+            fi
+        done
+    done
+    echo "  for states, transitions modes: same as in memory"
+
+    echo "Checking composition..."
+    # произведение с переименованной копией: соответствие по компонентам (--compose) и по скомпилированной композиции,
+    # покрытие переходов композиции - по JSON и по хранилищу, записанному fsm_compose
+    composed_file="${output_dir}/jsons/${seed}_composed.json"
+    composed_store="${output_dir}/stores/${seed}_composed"
+    rm -rf "$composed_store"
+    ./build/fsm_compose --kind product --out "$composed_file" --store "$composed_store" "$json_file" "$renamed_file" > /dev/null &&
+        ../Task_3/build/sequence_formation --mode=transitions --with-outputs --out="${seq_file}_composed.txt" "$composed_file" &&
+        ./build/coverage_checking --mode conformance --seq "${seq_file}_composed.txt" --compose product "$json_file" "$renamed_file" &&
+        ./build/coverage_checking --mode transitions --seq "${seq_file}_composed.txt" "$composed_file" &&
+        ./build/coverage_checking --mode transitions --seq "${seq_file}_composed.txt" --store "$composed_store"
+    if [ $? -eq 0 ]; then
+        echo "  product with a renamed copy: outputs match, transitions coveraged"
+    else
+        echo "Composition check failed"
+        exit 1
+    fi
+
     echo "----------"
 
     done
 
+    echo "Checking completion of an empty suite on a large tree..."
+    # двоичное дерево с тупиковыми листьями: у каждого листа своя последовательность; поиск пробела заново из каждого
+    # текущего состояния здесь квадратичен и не укладывается в timeout, однопроходное дополнение - секунды
+    tree_file="${output_dir}/jsons/tree.json"
+    awk -v n=262143 'BEGIN {
+        printf "{\"initial_state\": \"s0\", \"transitions\": {"
+        for (i = 0; i < n; i++) {
+            printf "%s\"s%d\": ", (i ? ", " : ""), i
+            if (2 * i + 1 < n) {
+                printf "{\"l\": {\"state\": \"s%d\", \"output\": \"ol\"}, \"r\": {\"state\": \"s%d\", \"output\": \"or\"}}", 2 * i + 1, 2 * i + 2
+            } else {
+                printf "\"\""
+            }
+        }
+        print "}}"
+    }' > "$tree_file"
+    : > "${output_dir}/sequences/tree_empty.txt"
+    for mode in states transitions; do
+        ./build/coverage_checking --mode $mode --seq "${output_dir}/sequences/tree_empty.txt" --coverage-out "${output_dir}/sequences/tree_empty.map" "$tree_file" > /dev/null 2>&1
+        timeout 30 ./build/coverage_checking --mode $mode --coverage-in "${output_dir}/sequences/tree_empty.map" --complete "${output_dir}/sequences/tree_top.txt" "$tree_file" > /dev/null 2>&1
+        if [ $? -eq 124 ] || ! ./build/coverage_checking --mode $mode --seq "${output_dir}/sequences/tree_top.txt" "$tree_file" > /dev/null; then
+            echo "Completion of an empty suite on a large tree failed in $mode mode"
+            exit 1
+        fi
+    done
+    echo "  for states, transitions modes: completed"
+
     echo "All machines generated and coverage checked successfully!!!"
@@ -8,50 +8,241 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 
 #include <vector>
+#include <array>
+#include <memory>
+#include <unordered_set>
+#include <unordered_map>
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <variant>
 
 #include <cstdint>
+#include <cstdlib>
+#include <cctype>
 #include <stdexcept>
-#include <random>
 
 namespace pt = boost::property_tree;
 namespace po = boost::program_options;
 
+// строка набора в виде значения (для вывода, учета вытеснений и записи в память)
 struct CacheLine {
-    std::uint32_t tag;
-    std::uint32_t data;
-    std::uint32_t last_used;
-    bool valid;
-    bool modif;
-    bool initialized;
+    std::uint32_t tag = 0;
+    std::uint32_t data = 0;
+    bool valid = false;
+    bool modif = false;
+    bool reused = false; // было ли попадание в строку после ее загрузки (для статистики вытеснений)
+};
+
+// политики вытеснения: состояние всех наборов лежит в общих массивах политики ([set * associativity + way] или по набору),
+// Cache параметризуется политикой, поэтому на горячем пути нет виртуальных вызовов. Интерфейс политики:
+//   Policy(int num_sets, int associativity)
+//   void on_hit(std::uint32_t set, int way) / void on_fill(std::uint32_t set, int way) - обращение / загрузка новой строки
+//   int victim(std::uint32_t set) - выбор жертвы, когда все строки набора заняты (свободные строки занимаются первыми)
+
+// LRU: 64-битное время последнего обращения (не переполняется)
+class LruPolicy {
+  public:
+    static constexpr const char* name = "lru";
+
+    LruPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t set, int way) { last_used[set * ways + way] = ++clock; }
+    void on_fill(std::uint32_t set, int way) { last_used[set * ways + way] = ++clock; }
+    int victim(std::uint32_t set) const;
 
-    CacheLine();
+  private:
+    int ways;
+    std::vector<std::uint64_t> last_used;
+    std::uint64_t clock = 0;
 };
 
-class CacheSet {
+// tree-PLRU: associativity - 1 бит в узлах двоичного дерева (одно слово на набор), бит указывает на менее недавно
+// использованную половину
+class PlruPolicy {
   public:
-    CacheSet(int associativity);
+    static constexpr const char* name = "plru";
+
+    PlruPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t set, int way) { touch(set, way); }
+    void on_fill(std::uint32_t set, int way) { touch(set, way); }
+    int victim(std::uint32_t set) const;
 
-    int find_line(std::uint32_t tag);
-    int find_victim();
+  private:
+    void touch(std::uint32_t set, int way);
 
-    CacheLine& get_line(int index);
-    void set_line(int index, const CacheLine& line);
+    std::vector<std::uint64_t> bits;
+    int levels = 0;
+};
+
+// FIFO: вытесняется строка, загруженная раньше всех (попадания порядок не меняют)
+class FifoPolicy {
+  public:
+    static constexpr const char* name = "fifo";
+
+    FifoPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t, int) {}
+    void on_fill(std::uint32_t set, int way) { inserted[set * ways + way] = ++clock; }
+    int victim(std::uint32_t set) const;
 
   private:
-    std::vector<CacheLine> lines;
+    int ways;
+    std::vector<std::uint64_t> inserted;
+    std::uint64_t clock = 0;
 };
 
-class Cache {
+// Random: xorshift с фиксированным зерном на набор, чтобы вывод одной трассы не менялся от запуска к запуску
+class RandomPolicy {
   public:
-    Cache(int cache_size, int line_size, int associativity);
+    static constexpr const char* name = "random";
 
-    void read(std::uint32_t addr, std::uint32_t expected_data);
+    RandomPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t, int) {}
+    void on_fill(std::uint32_t, int) {}
+    int victim(std::uint32_t set);
+
+  private:
+    int ways;
+    std::vector<std::uint64_t> states;
+};
+
+// NRU: бит обращения на строку (маска на набор); жертва - первая строка со сброшенным битом, если таких нет - биты сбрасываются
+class NruPolicy {
+  public:
+    static constexpr const char* name = "nru";
+
+    NruPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t set, int way) { referenced[set] |= std::uint64_t{1} << way; }
+    void on_fill(std::uint32_t set, int way) { referenced[set] |= std::uint64_t{1} << way; }
+    int victim(std::uint32_t set);
+
+  private:
+    std::uint64_t all_ways;
+    std::vector<std::uint64_t> referenced;
+};
+
+// RRIP (Jaleel и др., 2010): 2-битное предсказанное расстояние до следующего обращения (RRPV), попадание обнуляет его,
+// жертва - строка с RRPV = 3 (при отсутствии все RRPV набора увеличиваются). SRRIP загружает строку с RRPV = 2,
+// BRRIP - с RRPV = 3 и лишь каждую 32-ю загрузку набора с RRPV = 2 (устойчивость к сканированию)
+template <bool bimodal>
+class RripPolicy {
+  public:
+    static constexpr const char* name = bimodal ? "brrip" : "srrip";
+    static constexpr std::uint8_t max_rrpv = 3;
+    static constexpr std::uint32_t bimodal_period = 32;
+
+    RripPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t set, int way) { rrpv[set * ways + way] = 0; }
+    void on_fill(std::uint32_t set, int way);
+    int victim(std::uint32_t set);
+
+  private:
+    int ways;
+    std::vector<std::uint8_t> rrpv;
+    std::vector<std::uint32_t> fills;
+};
+
+using SrripPolicy = RripPolicy<false>;
+using BrripPolicy = RripPolicy<true>;
+
+// LFU: счетчик обращений с момента загрузки; жертва - строка с наименьшим счетчиком (при равенстве - с меньшим way)
+class LfuPolicy {
+  public:
+    static constexpr const char* name = "lfu";
+
+    LfuPolicy(int num_sets, int associativity);
+    void on_hit(std::uint32_t set, int way) { uses[set * ways + way]++; }
+    void on_fill(std::uint32_t set, int way) { uses[set * ways + way] = 1; }
+    int victim(std::uint32_t set) const;
+
+  private:
+    int ways;
+    std::vector<std::uint64_t> uses;
+};
+
+// оперативная память за кэшем: двухуровневая таблица страниц (каталог -> таблица -> страница 4 КБ, как у x86 без PAE),
+// страницы выделяются при первой записи, поэтому память модели растет только с занятым объемом;
+// память пословная (адрес выравнивается на 4 байта), записанные слова отмечены в битовой карте страницы:
+// содержимое остальных неизвестно (read дает ноль), и чтение такого слова берет значение из трассы
+class BackingMemory {
+  public:
+    static constexpr std::uint32_t page_bits = 12;
+    static constexpr std::uint32_t table_bits = 10;
+
+    std::uint32_t read(std::uint32_t addr) const;
+    bool written(std::uint32_t addr) const;
     void write(std::uint32_t addr, std::uint32_t data);
+    std::size_t allocated_pages() const { return pages; }
+    // объединение с памятью, в которую писали другие слова (--jobs: каждое слово пишет только рабочий, владеющий его
+    // строкой, у остальных оно нулевое и не отмечено), поэтому слова и битовые карты страниц объединяются побитовым ИЛИ
+    void merge(const BackingMemory& other);
 
   private:
-    std::vector<CacheSet> sets;
+    static constexpr std::uint32_t page_words = (1u << page_bits) / sizeof(std::uint32_t);
+
+    struct Page {
+        std::array<std::uint32_t, page_words> words{};
+        std::array<std::uint64_t, page_words / 64> written{};
+    };
+    using PageTable = std::array<std::unique_ptr<Page>, 1u << table_bits>;
+
+    std::array<std::unique_ptr<PageTable>, 1u << (32 - page_bits - table_bits)> directory;
+    std::size_t pages = 0;
+};
+
+// счетчики событий кэша: по каждому набору и в сумме
+// cold_misses - промахи по строке, к которой еще не было обращений (обязательные промахи),
+// dead_evictions - вытеснения строк, в которые после загрузки не было ни одного попадания
+struct CacheStats {
+    std::uint64_t reads = 0;
+    std::uint64_t writes = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t cold_misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t dirty_writebacks = 0;
+    std::uint64_t dead_evictions = 0;
+
+    CacheStats& operator+=(const CacheStats& other);
+};
+
+// трасса расходится с моделью (чтение неинициализированных данных, несовпадение прочитанных данных):
+// read/write моделей бросают его вместо завершения программы, а проигрывание трассы выводит сообщение и возвращает 1
+class TraceError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// общая для всех политик часть кэша: геометрия, строки, счетчики и память.
+// Строки всех наборов лежат в общих массивах (structure of arrays): теги и данные - по stride элементов на набор,
+// признаки valid/dirty/reused - битовые маски по way (до 64 way), поэтому поиск тега - сравнение всего набора
+// векторными инструкциями (AVX2, если процессор поддерживает, иначе SSE2) с маской попаданий на выходе
+class CacheModel {
+  public:
+    // quiet - без текстового вывода на каждое обращение (остаются только счетчики)
+    CacheModel(int cache_size, int line_size, int associativity, const char* policy_name, bool quiet);
+
+    const std::vector<CacheStats>& set_stats() const { return stats; }
+    CacheStats total_stats() const;
+    const BackingMemory& backing_memory() const { return memory; }
+    // сколько раз жертвой становилась строка каждого way
+    const std::vector<std::uint64_t>& victim_ways() const { return victims; }
+    const char* policy_name() const { return policy; }
+
+    std::uint32_t get_index(std::uint32_t addr) const;
+    // перенос результатов наборов [first, last) из копии модели, проигравшей их часть трассы (--jobs):
+    // счетчики этих наборов заменяются, гистограмма жертв суммируется, память объединяется
+    void absorb_sets(const CacheModel& part, std::uint32_t first, std::uint32_t last);
+
+  protected:
+    std::vector<CacheStats> stats;
+    std::vector<std::uint64_t> victims;
+    std::unordered_set<std::uint32_t> touched_lines; // номера строк памяти, к которым были обращения
+    BackingMemory memory;
+    const char* policy;
+    bool quiet;
     int line_size;
     int associativity;
     int num_sets;
@@ -60,10 +251,379 @@ class Cache {
     int offset_bits;
     int tag_bits;
 
-    std::uint32_t access_counter;
-    std::uint32_t get_index(std::uint32_t addr);
-    std::uint32_t get_tag(std::uint32_t addr);
+    int stride;             // associativity, округленная вверх до 8 (теги набора занимают целые регистры AVX2)
+    std::uint64_t all_ways; // маска существующих way
+    bool avx2;
+    std::vector<std::uint32_t> tags; // [set * stride + way]
+    std::vector<std::uint32_t> line_data;
+    std::vector<std::uint64_t> valid; // маски по набору: бит way
+    std::vector<std::uint64_t> dirty;
+    std::vector<std::uint64_t> reused;
+
+    std::uint32_t get_tag(std::uint32_t addr) const;
+
+    // way строки с тегом tag в наборе index или -1
+    int find_line(std::uint32_t index, std::uint32_t tag) const;
+    // первый свободный way набора или -1
+    int free_way(std::uint32_t index) const;
+    CacheLine line_at(std::uint32_t index, int way) const;
+    void store_line(std::uint32_t index, int way, std::uint32_t tag, std::uint32_t data, bool modified);
+    void clear_line(std::uint32_t index, int way);
+    void mark_hit(std::uint32_t index, int way) { reused[index] |= std::uint64_t{1} << way; }
+    // адрес начала строки с тегом tag в наборе index
+    std::uint32_t line_address(std::uint32_t index, std::uint32_t tag) const { return (tag << (index_bits + offset_bits)) | (index << offset_bits); }
+
+    void count_miss(std::uint32_t addr, std::uint32_t index);
+    // учет вытеснения строки victim из way (пустой way не считается)
+    void count_eviction(std::uint32_t index, int way, const CacheLine& victim);
+    void write_back(std::uint32_t index, const CacheLine& line);
+};
+
+template <typename Policy>
+class Cache : public CacheModel {
+  public:
+    Cache(int cache_size, int line_size, int associativity, bool quiet = false);
+
+    void read(std::uint32_t addr, std::uint32_t expected_data);
+    void write(std::uint32_t addr, std::uint32_t data);
+
+  private:
+    Policy policy;
+
+    // свободная строка, если она есть, иначе - жертва политики
+    int find_victim(std::uint32_t index);
     std::uint32_t get_way(std::uint32_t addr);
 };
 
+// выбор политики по имени из cache_descr.replacement_policy: f вызывается с PolicyTag<Policy>,
+// дальше весь код специализирован под политику
+template <typename Policy>
+struct PolicyTag {
+    using type = Policy;
+};
+
+template <typename F>
+void with_replacement_policy(const std::string& name, F&& f) {
+    if (name == LruPolicy::name) {
+        f(PolicyTag<LruPolicy>{});
+    } else if (name == PlruPolicy::name) {
+        f(PolicyTag<PlruPolicy>{});
+    } else if (name == FifoPolicy::name) {
+        f(PolicyTag<FifoPolicy>{});
+    } else if (name == RandomPolicy::name) {
+        f(PolicyTag<RandomPolicy>{});
+    } else if (name == NruPolicy::name) {
+        f(PolicyTag<NruPolicy>{});
+    } else if (name == SrripPolicy::name) {
+        f(PolicyTag<SrripPolicy>{});
+    } else if (name == BrripPolicy::name) {
+        f(PolicyTag<BrripPolicy>{});
+    } else if (name == LfuPolicy::name) {
+        f(PolicyTag<LfuPolicy>{});
+    } else {
+        throw std::invalid_argument("Invalid replacement policy: " + name + ". There're only 8 policies: lru/plru/fifo/random/nru/srrip/brrip/lfu");
+    }
+}
+
+// очередь одного производителя и одного потребителя на кольцевом буфере без блокировок (--jobs): индексы публикуются
+// пачками по publish_batch, поэтому атомарная запись приходится не на каждый элемент; ожидание активное, с уступкой
+// процессора, и перед ним каждая сторона публикует свой индекс, чтобы другая не ждала неопубликованную пачку
+template <typename T>
+class SpscQueue {
+  public:
+    static constexpr std::size_t publish_batch = 256;
+
+    // capacity - степень двойки, не меньше 2 * publish_batch
+    explicit SpscQueue(std::size_t capacity)
+        : buffer(capacity), mask(capacity - 1) {}
+
+    void push(const T& item) {
+        while (tail_local - head_cached == buffer.size()) {
+            head_cached = head.load(std::memory_order_acquire);
+            if (tail_local - head_cached == buffer.size()) {
+                tail.store(tail_local, std::memory_order_release);
+                std::this_thread::yield();
+            }
+        }
+        buffer[tail_local & mask] = item;
+        if (++tail_local % publish_batch == 0) {
+            tail.store(tail_local, std::memory_order_release);
+        }
+    }
+
+    // элементов больше не будет
+    void close() {
+        tail.store(tail_local, std::memory_order_release);
+        closed.store(true, std::memory_order_release);
+    }
+
+    // false - очередь закрыта и пуста
+    bool pop(T& item) {
+        while (head_local == tail_cached) {
+            tail_cached = tail.load(std::memory_order_acquire);
+            if (head_local != tail_cached) {
+                break;
+            }
+            head.store(head_local, std::memory_order_release);
+            if (closed.load(std::memory_order_acquire)) {
+                tail_cached = tail.load(std::memory_order_acquire);
+                if (head_local == tail_cached) {
+                    return false;
+                }
+                break;
+            }
+            std::this_thread::yield();
+        }
+        item = buffer[head_local & mask];
+        if (++head_local % publish_batch == 0) {
+            head.store(head_local, std::memory_order_release);
+        }
+        return true;
+    }
+
+  private:
+    std::vector<T> buffer;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head{0}; // публикует потребитель
+    alignas(64) std::atomic<std::size_t> tail{0}; // публикует производитель
+    alignas(64) std::atomic<bool> closed{false};
+    alignas(64) std::size_t tail_local = 0;       // поля производителя
+    std::size_t head_cached = 0;
+    alignas(64) std::size_t head_local = 0;       // поля потребителя
+    std::size_t tail_cached = 0;
+};
+
+// итоговая статистика: текстом (сумма и строка на каждый набор) или в JSON
+void print_stats(std::ostream& out, const CacheModel& cache, const std::string& format);
+
+// иерархия кэшей (cache_hierarchy в конфигурации): уровни L1..LN со своей геометрией и политикой вытеснения
+// и отношение включения между ними. Уровни хранят только теги и признаки строк, данные проверяются по общей памяти
+// иерархии (запись ядра сразу попадает в нее), а вытеснения и записи измененных строк учитываются по уровням
+
+// результат загрузки строки в уровень: way и строка, которая в нем была
+struct LevelFill {
+    int way = -1;
+    bool evicted = false;
+    bool evicted_dirty = false;
+    std::uint32_t evicted_addr = 0;
+};
+
+// политика уровня иерархии: у уровней cache_hierarchy политики могут быть разными, а уровни лежат в одном массиве,
+// поэтому политика выбирается по имени при загрузке и хранится в std::variant. Вызовы идут через switch по индексу
+// варианта, в каждой ветви - прямой (встраиваемый) вызов политики, без косвенного перехода
+class MixedPolicy {
+  public:
+    MixedPolicy(const std::string& name, int num_sets, int associativity);
+
+    void on_hit(std::uint32_t set, int way);
+    void on_fill(std::uint32_t set, int way);
+    int victim(std::uint32_t set);
+
+  private:
+    using Policies = std::variant<LruPolicy, PlruPolicy, FifoPolicy, RandomPolicy, NruPolicy, SrripPolicy, BrripPolicy, LfuPolicy>;
+    static_assert(std::variant_size_v<Policies> == 8, "dispatch() lists every policy");
+
+    Policies policies;
+
+    static Policies make_policies(const std::string& name, int num_sets, int associativity);
+
+    template <typename F>
+    decltype(auto) dispatch(F&& f) {
+        switch (policies.index()) {
+            case 0: return f(*std::get_if<0>(&policies));
+            case 1: return f(*std::get_if<1>(&policies));
+            case 2: return f(*std::get_if<2>(&policies));
+            case 3: return f(*std::get_if<3>(&policies));
+            case 4: return f(*std::get_if<4>(&policies));
+            case 5: return f(*std::get_if<5>(&policies));
+            case 6: return f(*std::get_if<6>(&policies));
+            default: return f(*std::get_if<7>(&policies));
+        }
+    }
+};
+
+inline void MixedPolicy::on_hit(std::uint32_t set, int way) {
+    dispatch([&](auto& policy) { policy.on_hit(set, way); });
+}
+
+inline void MixedPolicy::on_fill(std::uint32_t set, int way) {
+    dispatch([&](auto& policy) { policy.on_fill(set, way); });
+}
+
+inline int MixedPolicy::victim(std::uint32_t set) {
+    return dispatch([&](auto& policy) { return policy.victim(set); });
+}
+
+// уровень иерархии или частный кэш ядра с политикой вытеснения Policy (MixedPolicy - политика, выбранная по имени);
+// определения - в functions.cpp, с явными инстанцированиями для используемых политик
+template <typename Policy>
+class CacheLevel : public CacheModel {
+  public:
+    // policy_name нужен только MixedPolicy, у остальных политик имя задано типом
+    CacheLevel(const std::string& name, int cache_size, int line_size, int associativity, const std::string& policy_name = "");
+
+    const std::string& level_name() const { return name; }
+    int line_bytes() const { return line_size; }
+    std::uint32_t line_base(std::uint32_t addr) const { return addr & ~static_cast<std::uint32_t>(line_size - 1); }
+    // сколько строк уровень потерял из-за обратной инвалидации (инклюзивная иерархия)
+    std::uint64_t back_invalidations() const { return invalidated; }
+
+    // запрос ядра, промахнувшийся во всех уровнях выше: учитывается в счетчиках уровня, попадание обновляет политику;
+    // результат - way строки или -1 при промахе
+    int request(std::uint32_t addr, bool write);
+    // загрузка строки addr, которой нет в уровне
+    LevelFill fill(std::uint32_t addr, bool dirty, bool shared = false);
+    // пометить строку измененной (запись ядра в L1 или запись вытесненной строки из уровня выше); false, если строки нет
+    bool mark_dirty(std::uint32_t addr);
+    // удаление строки (обратная инвалидация, перенос в эксклюзивной иерархии, инвалидация протоколом когерентности);
+    // false, если строки нет
+    bool remove(std::uint32_t addr, bool& dirty);
+    void count_back_invalidation() { invalidated++; }
+
+    // состояние строки для протокола когерентности: dirty и shared задают M (1, 0), O (1, 1), E (0, 0) и S (0, 1);
+    // false, если строки нет (I)
+    bool line_state(std::uint32_t addr, bool& dirty, bool& shared) const;
+    bool set_line_state(std::uint32_t addr, bool dirty, bool shared);
+
+  private:
+    Policy policy;
+    std::string name;
+    std::uint64_t invalidated = 0;
+    std::vector<std::uint64_t> shared; // маски по набору: бит way, если копия строки может быть у других ядер
+};
+
+// отношение между уровнями: inclusive - уровень содержит все строки уровней выше (вытеснение инвалидирует их копии),
+// exclusive - строка есть не более чем в одном уровне (вытесненные строки переходят уровнем ниже),
+// nine (non-inclusive non-exclusive) - строки загружаются во все уровни, но вытеснение не затрагивает другие уровни
+enum class Inclusion {
+    inclusive,
+    exclusive,
+    nine
+};
+
+Inclusion parse_inclusion(const std::string& name);
+const char* inclusion_name(Inclusion inclusion);
+
+class CacheHierarchy {
+  public:
+    // уровни от ближайшего к ядру; размер строки не убывает вниз по иерархии, в эксклюзивной иерархии он одинаковый
+    CacheHierarchy(std::vector<std::unique_ptr<CacheLevel<MixedPolicy>>> levels, Inclusion inclusion, bool quiet);
+
+    void read(std::uint32_t addr, std::uint32_t expected_data);
+    void write(std::uint32_t addr, std::uint32_t data);
+
+    const std::vector<std::unique_ptr<CacheLevel<MixedPolicy>>>& cache_levels() const { return levels; }
+    Inclusion inclusion_policy() const { return inclusion; }
+    const BackingMemory& backing_memory() const { return memory; }
+    // строки, прочитанные из памяти, и измененные строки, записанные в нее при вытеснении из последнего уровня
+    std::uint64_t memory_reads() const { return ram_reads; }
+    std::uint64_t memory_writebacks() const { return ram_writebacks; }
+
+  private:
+    std::vector<std::unique_ptr<CacheLevel<MixedPolicy>>> levels;
+    Inclusion inclusion;
+    bool quiet;
+    BackingMemory memory;
+    std::uint64_t ram_reads = 0;
+    std::uint64_t ram_writebacks = 0;
+
+    void access(std::uint32_t addr, bool write);
+    void fill(std::size_t level, std::uint32_t addr, bool dirty);
+    // вытесненная строка уровня level: обратная инвалидация, запись ниже или перенос в следующий уровень
+    void evict(std::size_t level, std::uint32_t addr, bool dirty);
+    void write_back(std::size_t level, std::uint32_t addr);
+};
+
+// иерархия по описанию cache_hierarchy: inclusion и массив levels с полями как у cache_descr (и необязательным name)
+CacheHierarchy load_cache_hierarchy(const pt::ptree& descr, bool quiet);
+
+void print_stats(std::ostream& out, const CacheHierarchy& hierarchy, const std::string& format);
+
+// несколько ядер с частными кэшами одинаковой геометрии (cache_descr), согласованными протоколом когерентности
+// (блок coherence: cores и protocol) на общей шине: промах чтения - BusRd, промах записи - BusRdX,
+// запись в строку S или O - BusUpgr; остальные кэши отслеживают транзакции шины (snooping).
+// Как и в иерархии, кэши хранят только состояние строк, а данные проверяются по общей памяти
+enum class Coherence {
+    mesi,
+    moesi // измененная строка отдается читателю без записи в память и остается у владельца в состоянии O
+};
+
+Coherence parse_coherence(const std::string& name);
+const char* coherence_name(Coherence protocol);
+
+// события протокола для одного ядра
+struct CoherenceStats {
+    std::uint64_t upgrade_misses = 0;         // запись в строку S/O: данные есть, но нужна транзакция BusUpgr
+    std::uint64_t invalidations_sent = 0;     // копии других ядер, инвалидированные записями этого ядра
+    std::uint64_t invalidations_received = 0; // копии этого ядра, инвалидированные записями других ядер
+    std::uint64_t interventions = 0;          // измененная строка (M/O) передана другому ядру из этого кэша
+    std::uint64_t coherence_misses = 0;       // промахи по строкам, которые ядро потеряло из-за инвалидации
+    std::uint64_t true_sharing_misses = 0;    // ... и слово которых с тех пор записывало другое ядро
+    std::uint64_t false_sharing_misses = 0;   // ... и слово которых никто не записывал (делится только строка)
+};
+
+// строка, к которой обращались несколько ядер: счетчики для поиска ложного разделения
+struct LineSharing {
+    std::uint32_t addr = 0;
+    std::uint64_t cores = 0; // маска ядер, обращавшихся к строке
+    std::uint64_t invalidations = 0;
+    std::uint64_t true_sharing_misses = 0;
+    std::uint64_t false_sharing_misses = 0;
+};
+
+// политика вытеснения у всех ядер одна (cache_descr.replacement_policy), поэтому модель параметризуется ею целиком
+template <typename Policy>
+class CoherentCaches {
+  public:
+    // не больше 64 ядер (маски ядер - 64-битные)
+    CoherentCaches(std::vector<CacheLevel<Policy>> caches, Coherence protocol, bool quiet);
+
+    void read(std::uint32_t core, std::uint32_t addr, std::uint32_t expected_data);
+    void write(std::uint32_t core, std::uint32_t addr, std::uint32_t data);
+
+    std::size_t cores() const { return caches.size(); }
+    const std::vector<CacheLevel<Policy>>& core_caches() const { return caches; }
+    const std::vector<CoherenceStats>& coherence_stats() const { return events; }
+    Coherence protocol_kind() const { return protocol; }
+    const BackingMemory& backing_memory() const { return memory; }
+    std::uint64_t memory_reads() const { return ram_reads; }
+    std::uint64_t memory_writebacks() const { return ram_writebacks; }
+    // до limit строк с наибольшим числом промахов ложного разделения (затем - инвалидаций)
+    std::vector<LineSharing> hot_lines(std::size_t limit) const;
+
+  private:
+    // слова строки, записанные другими ядрами после того, как ядро потеряло строку
+    struct SharingHistory {
+        LineSharing counters;
+        std::uint64_t lost = 0; // маска ядер, копии которых инвалидированы
+        std::vector<std::uint64_t> written_words;
+    };
+
+    std::vector<CacheLevel<Policy>> caches;
+    Coherence protocol;
+    bool quiet;
+    BackingMemory memory;
+    std::vector<CoherenceStats> events;
+    std::unordered_map<std::uint32_t, SharingHistory> sharing;
+    std::uint64_t ram_reads = 0;
+    std::uint64_t ram_writebacks = 0;
+
+    SharingHistory& history(std::uint32_t line);
+    std::uint64_t word_bit(std::uint32_t addr) const;
+    // промах ядра core: был ли он вызван инвалидацией (и какого вида разделение)
+    void classify_miss(std::uint32_t core, std::uint32_t addr);
+    // инвалидация копий строки во всех кэшах, кроме core; true, если одна из копий была измененной (M/O)
+    bool invalidate_others(std::uint32_t core, std::uint32_t addr);
+    void fill(std::uint32_t core, std::uint32_t addr, bool dirty, bool shared);
+    void print_transition(std::uint32_t core, const char* event, std::uint32_t addr, bool dirty, bool shared) const;
+};
+
+// ядра по cache_descr и блоку coherence (cores, protocol: mesi/moesi); политику по имени из cache_descr
+// выбирает вызывающий (with_replacement_policy), как и для одиночного кэша
+template <typename Policy>
+CoherentCaches<Policy> load_coherent_caches(const pt::ptree& root, bool quiet);
+
+template <typename Policy>
+void print_stats(std::ostream& out, const CoherentCaches<Policy>& system, const std::string& format);
+
 #endif
\ No newline at end of file
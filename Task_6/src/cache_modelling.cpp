@@ -1,10 +1,202 @@
 #include "functions.hpp"
 
+// операция трассы: "[<core>] <op> <addr> <data>", номер ядра (десятичный) есть только в трассах нескольких ядер;
+// line - номер строки трассы (с 1), по нему --jobs выбирает, какую из ошибок рабочих потоков сообщить
+struct Operation {
+    std::uint32_t core = 0;
+    char op = '\0';
+    std::uint32_t addr = 0;
+    std::uint32_t data = 0;
+    std::uint64_t line = 0;
+};
+
+// первая ошибка при проигрывании трассы; line == 0 - ошибки не было
+struct TraceFailure {
+    std::uint64_t line = 0;
+    std::string message;
+};
+
+// разбор без istringstream: на длинных трассах он заметнее самой модели
+Operation parse_operation(const std::string& line) {
+    Operation operation;
+    auto first = std::min(line.find_first_not_of(" \t"), line.size());
+    if (first < line.size() && std::isdigit(static_cast<unsigned char>(line[first]))) {
+        char* end = nullptr;
+        operation.core = static_cast<std::uint32_t>(std::strtoul(line.c_str() + first, &end, 10));
+        first = std::min(line.find_first_not_of(" \t", end - line.c_str()), line.size());
+    }
+    operation.op = first < line.size() ? line[first] : '\0';
+    char* end = nullptr;
+    operation.addr = static_cast<std::uint32_t>(std::strtoul(line.c_str() + std::min(first + 1, line.size()), &end, 16));
+    operation.data = static_cast<std::uint32_t>(std::strtoul(end, nullptr, 16));
+    return operation;
+}
+
+// проигрывание трассы на одиночном кэше или иерархии; 0 - успех, иначе код завершения программы
+template <typename Model>
+int simulate(Model& cache, std::istream& operations_file) {
+    std::string line;
+    while (std::getline(operations_file, line)) {
+        auto operation = parse_operation(line);
+        if (operation.core != 0) {
+            std::cerr << "Core ID " << operation.core << " in trace needs the coherence block in config" << std::endl;
+            return 1;
+        }
+
+        try {
+            if (operation.op == 'R') {
+                cache.read(operation.addr, operation.data);
+            } else if (operation.op == 'W') {
+                cache.write(operation.addr, operation.data);
+            } else {
+                std::cerr << "Unknown operation: " << operation.op << std::endl;
+                return 1;
+            }
+        } catch (const TraceError& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// --jobs: поток чтения раскладывает обращения по наборам в очереди рабочих потоков; у каждого рабочего своя копия кэша,
+// в которой он ведет только свой непрерывный диапазон наборов. Наборы одиночного кэша независимы (и строка памяти
+// принадлежит одному набору), поэтому после слияния счетчиков результат совпадает с последовательным проигрыванием
+template <typename Policy>
+int simulate_parallel(Cache<Policy>& cache, std::istream& operations_file, int jobs, int cache_size, int line_size, int associativity) {
+    auto num_sets = static_cast<std::uint32_t>(cache.set_stats().size());
+    auto workers = std::min(static_cast<std::uint32_t>(jobs), num_sets);
+
+    // рабочий 0 ведет наборы в самом cache
+    std::vector<std::unique_ptr<Cache<Policy>>> parts;
+    std::vector<Cache<Policy>*> models{&cache};
+    for (std::uint32_t worker = 1; worker < workers; ++worker) {
+        parts.push_back(std::make_unique<Cache<Policy>>(cache_size, line_size, associativity, true));
+        models.push_back(parts.back().get());
+    }
+
+    std::vector<std::uint32_t> first_set(workers + 1);
+    std::vector<std::uint32_t> owner(num_sets);
+    for (std::uint32_t worker = 0; worker <= workers; ++worker) {
+        first_set[worker] = static_cast<std::uint32_t>(static_cast<std::uint64_t>(num_sets) * worker / workers);
+    }
+    for (std::uint32_t worker = 0; worker < workers; ++worker) {
+        std::fill(owner.begin() + first_set[worker], owner.begin() + first_set[worker + 1], worker);
+    }
+
+    // рабочий запоминает свою первую ошибку и дальше только разбирает очередь (иначе поток чтения встанет на полной
+    // очереди); чтение трассы останавливается после первой ошибки любого потока. Обращения с меньшими номерами строк к
+    // этому моменту уже разложены по очередям и будут проиграны, поэтому из ошибок сообщается ошибка с наименьшим
+    // номером строки - та же, что и при последовательном проигрывании
+    std::vector<std::unique_ptr<SpscQueue<Operation>>> queues;
+    std::vector<TraceFailure> failures(workers + 1);
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (std::uint32_t worker = 0; worker < workers; ++worker) {
+        queues.push_back(std::make_unique<SpscQueue<Operation>>(1u << 16));
+    }
+    for (std::uint32_t worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([queue = queues[worker].get(), model = models[worker], failure = &failures[worker], &failed] {
+            Operation operation;
+            while (queue->pop(operation)) {
+                if (failure->line != 0) {
+                    continue;
+                }
+                try {
+                    if (operation.op == 'R') {
+                        model->read(operation.addr, operation.data);
+                    } else {
+                        model->write(operation.addr, operation.data);
+                    }
+                } catch (const TraceError& e) {
+                    failure->line = operation.line;
+                    failure->message = e.what();
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    // ошибки разбора трассы находит поток чтения
+    auto& read_failure = failures[workers];
+    std::string line;
+    std::uint64_t line_number = 0;
+    while (!failed.load(std::memory_order_relaxed) && std::getline(operations_file, line)) {
+        auto operation = parse_operation(line);
+        operation.line = ++line_number;
+        if (operation.core != 0) {
+            read_failure.line = operation.line;
+            read_failure.message = "Core ID " + std::to_string(operation.core) + " in trace needs the coherence block in config";
+            break;
+        }
+        if (operation.op != 'R' && operation.op != 'W') {
+            read_failure.line = operation.line;
+            read_failure.message = std::string("Unknown operation: ") + operation.op;
+            break;
+        }
+        queues[owner[cache.get_index(operation.addr)]]->push(operation);
+    }
+
+    for (auto& queue : queues) {
+        queue->close();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const TraceFailure* first_failure = nullptr;
+    for (const auto& failure : failures) {
+        if (failure.line != 0 && (first_failure == nullptr || failure.line < first_failure->line)) {
+            first_failure = &failure;
+        }
+    }
+    if (first_failure != nullptr) {
+        std::cerr << first_failure->message << std::endl;
+        return 1;
+    }
+
+    for (std::uint32_t worker = 1; worker < workers; ++worker) {
+        cache.absorb_sets(*models[worker], first_set[worker], first_set[worker + 1]);
+    }
+    return 0;
+}
+
+// трасса нескольких ядер; строки без номера ядра относятся к ядру 0
+template <typename Policy>
+int simulate_cores(CoherentCaches<Policy>& system, std::istream& operations_file) {
+    std::string line;
+    while (std::getline(operations_file, line)) {
+        auto operation = parse_operation(line);
+        if (operation.core >= system.cores()) {
+            std::cerr << "Invalid core ID: " << operation.core << ". There're only " << system.cores() << " cores" << std::endl;
+            return 1;
+        }
+
+        try {
+            if (operation.op == 'R') {
+                system.read(operation.core, operation.addr, operation.data);
+            } else if (operation.op == 'W') {
+                system.write(operation.core, operation.addr, operation.data);
+            } else {
+                std::cerr << "Unknown operation: " << operation.op << std::endl;
+                return 1;
+            }
+        } catch (const TraceError& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     try {
 
         po::options_description desc("Allowed options");
-        desc.add_options()("help", "produce help message")("config", po::value<std::string>(), "JSON file with cache description")("input", po::value<std::string>(), "File with operations");
+        desc.add_options()("help", "produce help message")("config", po::value<std::string>(), "JSON file with cache description (cache_descr, cache_descr with coherence, or cache_hierarchy)")("input", po::value<std::string>(), "File with operations (\"[<core>] <R|W> <addr> <data>\")")("quiet", "do not print per-access messages")("stats", "print hit/miss/eviction/dirty writeback/cold miss counters (globally and per set) at the end")("stats-format", po::value<std::string>()->default_value("text"), "statistics format (text/json)")("jobs", po::value<int>()->default_value(1), "worker threads for a single cache: sets are split between them (needs --quiet)");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -26,11 +218,25 @@ int main(int argc, char* argv[]) {
         pt::ptree root;
         pt::read_json(config_file, root);
 
-        auto line_size = root.get<int>("cache_descr.line_size");
-        auto associativity = root.get<int>("cache_descr.associativity");
-        auto cache_size = root.get<int>("cache_descr.cache_size");
+        auto stats_format = vm["stats-format"].as<std::string>();
+        if (stats_format != "text" && stats_format != "json") {
+            std::cerr << "Invalid statistics format: " << stats_format << ". There're only 2 formats: text/json" << std::endl;
+            return 1;
+        }
 
-        Cache cache(cache_size, line_size, associativity);
+        auto jobs = vm["jobs"].as<int>();
+        if (jobs < 1) {
+            std::cerr << "Invalid number of jobs: " << jobs << std::endl;
+            return 1;
+        }
+        if (jobs > 1 && !vm.count("quiet")) {
+            std::cerr << "--jobs needs --quiet: per-access messages of parallel workers would interleave" << std::endl;
+            return 1;
+        }
+        if (jobs > 1 && (root.get_child_optional("coherence") || root.get_child_optional("cache_hierarchy"))) {
+            std::cerr << "--jobs works only with a single cache (cache_descr)" << std::endl;
+            return 1;
+        }
 
         std::ifstream operations_file(input_file);
         if (!operations_file) {
@@ -38,25 +244,46 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        std::string line;
-        while (std::getline(operations_file, line)) {
-            std::istringstream iss(line);
-            char op;
-            std::uint32_t addr;
-            std::uint32_t data;
-            iss >> op >> std::hex >> addr >> std::hex >> data;
+        // несколько ядер с частными кэшами cache_descr, согласованными протоколом когерентности
+        if (root.get_child_optional("coherence")) {
+            auto policy = root.get<std::string>("cache_descr.replacement_policy", LruPolicy::name);
+            auto returned = 0;
+            with_replacement_policy(policy, [&](auto tag) {
+                using Policy = typename decltype(tag)::type;
+                auto system = load_coherent_caches<Policy>(root, vm.count("quiet") > 0);
+                returned = simulate_cores(system, operations_file);
+                if (returned == 0 && vm.count("stats")) {
+                    print_stats(std::cout, system, stats_format);
+                }
+            });
+            return returned;
+        }
 
-            if (op == 'R') {
-                cache.read(addr, data);
-            } else if (op == 'W') {
-                cache.write(addr, data);
-            } else {
-                std::cerr << "Unknown operation: " << op << std::endl;
-                return 1;
+        // иерархия уровней вместо одиночного кэша
+        if (auto hierarchy_descr = root.get_child_optional("cache_hierarchy")) {
+            auto hierarchy = load_cache_hierarchy(*hierarchy_descr, vm.count("quiet") > 0);
+            auto returned = simulate(hierarchy, operations_file);
+            if (returned == 0 && vm.count("stats")) {
+                print_stats(std::cout, hierarchy, stats_format);
             }
+            return returned;
         }
 
-        return 0;
+        auto line_size = root.get<int>("cache_descr.line_size");
+        auto associativity = root.get<int>("cache_descr.associativity");
+        auto cache_size = root.get<int>("cache_descr.cache_size");
+        auto policy = root.get<std::string>("cache_descr.replacement_policy", LruPolicy::name);
+
+        auto returned = 0;
+        with_replacement_policy(policy, [&](auto tag) {
+            using Policy = typename decltype(tag)::type;
+            Cache<Policy> cache(cache_size, line_size, associativity, vm.count("quiet") > 0);
+            returned = jobs > 1 ? simulate_parallel(cache, operations_file, jobs, cache_size, line_size, associativity) : simulate(cache, operations_file);
+            if (returned == 0 && vm.count("stats")) {
+                print_stats(std::cout, cache, stats_format);
+            }
+        });
+        return returned;
 
     } catch (const po::error& e) {
         std::cerr << "Command line error: " << e.what() << "\n";
@@ -1,110 +1,446 @@
 #include "functions.hpp"
 
-CacheLine::CacheLine()
-    : tag(0), data(0), last_used(0), valid(false), modif(false), initialized(false) {}
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-CacheSet::CacheSet(int associativity) {
-    lines.resize(associativity);
+LruPolicy::LruPolicy(int num_sets, int associativity)
+    : ways(associativity), last_used(static_cast<std::size_t>(num_sets) * associativity, 0) {}
+
+int LruPolicy::victim(std::uint32_t set) const {
+    auto begin = last_used.begin() + set * ways;
+    return static_cast<int>(std::min_element(begin, begin + ways) - begin);
+}
+
+PlruPolicy::PlruPolicy(int num_sets, int associativity)
+    : bits(num_sets, 0) {
+    if (associativity <= 0 || (associativity & (associativity - 1)) != 0) {
+        throw std::invalid_argument("plru replacement policy needs a power of two associativity");
+    }
+    while ((1 << levels) < associativity) {
+        levels++;
+    }
+}
+
+// путь от корня к way: каждый узел на пути указывает в другую половину
+void PlruPolicy::touch(std::uint32_t set, int way) {
+    auto& tree = bits[set];
+    int node = 0;
+    for (int level = levels - 1; level >= 0; --level) {
+        auto bit = (way >> level) & 1;
+        tree = (tree & ~(std::uint64_t{1} << node)) | (static_cast<std::uint64_t>(!bit) << node);
+        node = 2 * node + 1 + bit;
+    }
+}
+
+int PlruPolicy::victim(std::uint32_t set) const {
+    auto tree = bits[set];
+    int node = 0;
+    auto way = 0;
+    for (int level = 0; level < levels; ++level) {
+        auto bit = static_cast<int>((tree >> node) & 1);
+        way = way * 2 + bit;
+        node = 2 * node + 1 + bit;
+    }
+    return way;
+}
+
+FifoPolicy::FifoPolicy(int num_sets, int associativity)
+    : ways(associativity), inserted(static_cast<std::size_t>(num_sets) * associativity, 0) {}
+
+int FifoPolicy::victim(std::uint32_t set) const {
+    auto begin = inserted.begin() + set * ways;
+    return static_cast<int>(std::min_element(begin, begin + ways) - begin);
+}
+
+RandomPolicy::RandomPolicy(int num_sets, int associativity)
+    : ways(associativity), states(num_sets) {
+    for (std::size_t set = 0; set < states.size(); ++set) {
+        states[set] = 0x9e3779b97f4a7c15ull * (set + 1);
+    }
+}
+
+int RandomPolicy::victim(std::uint32_t set) {
+    auto& state = states[set];
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<int>(state % ways);
+}
+
+NruPolicy::NruPolicy(int num_sets, int associativity)
+    : all_ways(associativity == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << associativity) - 1), referenced(num_sets, 0) {}
+
+int NruPolicy::victim(std::uint32_t set) {
+    auto free = ~referenced[set] & all_ways;
+    if (free) {
+        return __builtin_ctzll(free);
+    }
+    referenced[set] = 0;
+    return 0;
+}
+
+template <bool bimodal>
+RripPolicy<bimodal>::RripPolicy(int num_sets, int associativity)
+    : ways(associativity), rrpv(static_cast<std::size_t>(num_sets) * associativity, max_rrpv), fills(num_sets, 0) {}
+
+template <bool bimodal>
+void RripPolicy<bimodal>::on_fill(std::uint32_t set, int way) {
+    if (bimodal) {
+        rrpv[set * ways + way] = (++fills[set] % bimodal_period == 0) ? max_rrpv - 1 : max_rrpv;
+    } else {
+        rrpv[set * ways + way] = max_rrpv - 1;
+    }
 }
 
-int CacheSet::find_line(std::uint32_t tag) {
-    for (int i = 0; i < lines.size(); ++i) {
-        if (lines[i].valid && lines[i].tag == tag) {
-            return i;
+template <bool bimodal>
+int RripPolicy<bimodal>::victim(std::uint32_t set) {
+    auto values = rrpv.begin() + set * ways;
+    while (true) {
+        for (int way = 0; way < ways; ++way) {
+            if (values[way] == max_rrpv) {
+                return way;
+            }
+        }
+        for (int way = 0; way < ways; ++way) {
+            values[way]++;
         }
     }
-    return -1;
 }
 
-int CacheSet::find_victim() {
-    auto LRU_index = 0;
-    for (int i = 1; i < lines.size(); ++i) {
-        if (lines[i].last_used < lines[LRU_index].last_used) {
-            LRU_index = i;
+LfuPolicy::LfuPolicy(int num_sets, int associativity)
+    : ways(associativity), uses(static_cast<std::size_t>(num_sets) * associativity, 0) {}
+
+int LfuPolicy::victim(std::uint32_t set) const {
+    auto begin = uses.begin() + set * ways;
+    return static_cast<int>(std::min_element(begin, begin + ways) - begin);
+}
+
+std::uint32_t BackingMemory::read(std::uint32_t addr) const {
+    const auto& table = directory[addr >> (page_bits + table_bits)];
+    if (!table) {
+        return 0;
+    }
+    const auto& page = (*table)[(addr >> page_bits) & ((1u << table_bits) - 1)];
+    return page ? page->words[(addr & ((1u << page_bits) - 1)) / sizeof(std::uint32_t)] : 0;
+}
+
+bool BackingMemory::written(std::uint32_t addr) const {
+    const auto& table = directory[addr >> (page_bits + table_bits)];
+    if (!table) {
+        return false;
+    }
+    const auto& page = (*table)[(addr >> page_bits) & ((1u << table_bits) - 1)];
+    auto word = (addr & ((1u << page_bits) - 1)) / sizeof(std::uint32_t);
+    return page && ((page->written[word / 64] >> (word % 64)) & 1);
+}
+
+void BackingMemory::write(std::uint32_t addr, std::uint32_t data) {
+    auto& table = directory[addr >> (page_bits + table_bits)];
+    if (!table) {
+        table = std::make_unique<PageTable>();
+    }
+    auto& page = (*table)[(addr >> page_bits) & ((1u << table_bits) - 1)];
+    if (!page) {
+        page = std::make_unique<Page>();
+        pages++;
+    }
+    auto word = (addr & ((1u << page_bits) - 1)) / sizeof(std::uint32_t);
+    page->words[word] = data;
+    page->written[word / 64] |= std::uint64_t{1} << (word % 64);
+}
+
+void BackingMemory::merge(const BackingMemory& other) {
+    for (std::size_t table_index = 0; table_index < other.directory.size(); ++table_index) {
+        const auto& other_table = other.directory[table_index];
+        if (!other_table) {
+            continue;
+        }
+        auto& table = directory[table_index];
+        if (!table) {
+            table = std::make_unique<PageTable>();
+        }
+        for (std::size_t page_index = 0; page_index < other_table->size(); ++page_index) {
+            const auto& other_page = (*other_table)[page_index];
+            if (!other_page) {
+                continue;
+            }
+            auto& page = (*table)[page_index];
+            if (!page) {
+                page = std::make_unique<Page>(*other_page);
+                pages++;
+                continue;
+            }
+            for (std::size_t word = 0; word < page->words.size(); ++word) {
+                page->words[word] |= other_page->words[word];
+            }
+            for (std::size_t bits = 0; bits < page->written.size(); ++bits) {
+                page->written[bits] |= other_page->written[bits];
+            }
         }
     }
-    return LRU_index;
 }
 
-CacheLine& CacheSet::get_line(int index) {
-    return lines[index];
+CacheStats& CacheStats::operator+=(const CacheStats& other) {
+    reads += other.reads;
+    writes += other.writes;
+    hits += other.hits;
+    misses += other.misses;
+    cold_misses += other.cold_misses;
+    evictions += other.evictions;
+    dirty_writebacks += other.dirty_writebacks;
+    dead_evictions += other.dead_evictions;
+    return *this;
 }
 
-void CacheSet::set_line(int index, const CacheLine& line) {
-    lines[index] = line;
+namespace {
+
+// маска way, теги которых равны tag; теги набора дополнены до stride (кратно 8) элементов
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) std::uint64_t match_tags_avx2(const std::uint32_t* tags, int stride, std::uint32_t tag) {
+    auto needle = _mm256_set1_epi32(static_cast<int>(tag));
+    std::uint64_t mask = 0;
+    for (int way = 0; way < stride; way += 8) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags + way));
+        auto equal = _mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, needle));
+        mask |= static_cast<std::uint64_t>(_mm256_movemask_ps(equal)) << way;
+    }
+    return mask;
+}
+
+__attribute__((target("sse2"))) std::uint64_t match_tags_sse2(const std::uint32_t* tags, int stride, std::uint32_t tag) {
+    auto needle = _mm_set1_epi32(static_cast<int>(tag));
+    std::uint64_t mask = 0;
+    for (int way = 0; way < stride; way += 4) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + way));
+        auto equal = _mm_castsi128_ps(_mm_cmpeq_epi32(chunk, needle));
+        mask |= static_cast<std::uint64_t>(_mm_movemask_ps(equal)) << way;
+    }
+    return mask;
+}
+#else
+std::uint64_t match_tags_scalar(const std::uint32_t* tags, int stride, std::uint32_t tag) {
+    std::uint64_t mask = 0;
+    for (int way = 0; way < stride; ++way) {
+        mask |= static_cast<std::uint64_t>(tags[way] == tag) << way;
+    }
+    return mask;
 }
+#endif
 
-Cache::Cache(int cache_size, int line_size, int associativity)
-    : line_size(line_size), associativity(associativity), access_counter(0) {
+TraceError data_mismatch(std::uint32_t expected, std::uint32_t found) {
+    std::ostringstream message;
+    message << "Data mismatch! Expected: 0x"
+            << std::hex << std::setw(8) << std::setfill('0') << expected
+            << ", Found: 0x"
+            << std::hex << std::setw(8) << std::setfill('0') << found;
+    return TraceError(message.str());
+}
+
+} // namespace
+
+CacheModel::CacheModel(int cache_size, int line_size, int associativity, const char* policy_name, bool quiet)
+    : victims(associativity, 0), policy(policy_name), quiet(quiet), line_size(line_size), associativity(associativity) {
+    if (associativity <= 0 || associativity > 64) {
+        throw std::invalid_argument("associativity must be in range [1, 64]");
+    }
     num_sets = cache_size / (line_size * associativity);
-    sets.resize(num_sets, CacheSet(associativity));
+    stats.resize(num_sets);
     index_bits = static_cast<int>(std::log2(num_sets));
     offset_bits = static_cast<int>(std::log2(line_size));
     tag_bits = 32 - index_bits - offset_bits;
+
+    stride = (associativity + 7) & ~7;
+    all_ways = associativity == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << associativity) - 1;
+#if defined(__x86_64__) || defined(__i386__)
+    avx2 = __builtin_cpu_supports("avx2");
+#else
+    avx2 = false;
+#endif
+    tags.assign(static_cast<std::size_t>(num_sets) * stride, 0);
+    line_data.assign(tags.size(), 0);
+    valid.assign(num_sets, 0);
+    dirty.assign(num_sets, 0);
+    reused.assign(num_sets, 0);
 }
 
-std::uint32_t Cache::get_index(std::uint32_t addr) {
+std::uint32_t CacheModel::get_index(std::uint32_t addr) const {
     return (addr >> offset_bits) & ((1 << index_bits) - 1);
 }
 
-std::uint32_t Cache::get_tag(uint32_t addr) {
+std::uint32_t CacheModel::get_tag(uint32_t addr) const {
     return addr >> (offset_bits + index_bits);
 }
 
-std::uint32_t Cache::get_way(std::uint32_t addr) {
+int CacheModel::find_line(std::uint32_t index, std::uint32_t tag) const {
+    const auto* set_tags = tags.data() + static_cast<std::size_t>(index) * stride;
+#if defined(__x86_64__) || defined(__i386__)
+    auto mask = avx2 ? match_tags_avx2(set_tags, stride, tag) : match_tags_sse2(set_tags, stride, tag);
+#else
+    auto mask = match_tags_scalar(set_tags, stride, tag);
+#endif
+    mask &= valid[index];
+    return mask ? __builtin_ctzll(mask) : -1;
+}
+
+int CacheModel::free_way(std::uint32_t index) const {
+    auto free = ~valid[index] & all_ways;
+    return free ? __builtin_ctzll(free) : -1;
+}
+
+CacheLine CacheModel::line_at(std::uint32_t index, int way) const {
+    auto slot = static_cast<std::size_t>(index) * stride + way;
+    CacheLine line;
+    line.tag = tags[slot];
+    line.data = line_data[slot];
+    line.valid = (valid[index] >> way) & 1;
+    line.modif = (dirty[index] >> way) & 1;
+    line.reused = (reused[index] >> way) & 1;
+    return line;
+}
+
+void CacheModel::store_line(std::uint32_t index, int way, std::uint32_t tag, std::uint32_t data, bool modified) {
+    auto slot = static_cast<std::size_t>(index) * stride + way;
+    auto bit = std::uint64_t{1} << way;
+    tags[slot] = tag;
+    line_data[slot] = data;
+    valid[index] |= bit;
+    dirty[index] = modified ? dirty[index] | bit : dirty[index] & ~bit;
+    reused[index] &= ~bit;
+}
+
+void CacheModel::clear_line(std::uint32_t index, int way) {
+    auto bit = std::uint64_t{1} << way;
+    valid[index] &= ~bit;
+    dirty[index] &= ~bit;
+    reused[index] &= ~bit;
+}
+
+template <typename Policy>
+Cache<Policy>::Cache(int cache_size, int line_size, int associativity, bool quiet)
+    : CacheModel(cache_size, line_size, associativity, Policy::name, quiet), policy(num_sets, associativity) {}
+
+template <typename Policy>
+int Cache<Policy>::find_victim(std::uint32_t index) {
+    auto way = free_way(index);
+    return way != -1 ? way : policy.victim(index);
+}
+
+template <typename Policy>
+std::uint32_t Cache<Policy>::get_way(std::uint32_t addr) {
     auto index = get_index(addr);
     auto tag = get_tag(addr);
 
-    auto way = sets[index].find_line(tag);
+    auto way = find_line(index, tag);
 
     if (way == -1) {
-        way = sets[index].find_victim();
+        way = find_victim(index);
     }
 
     return way;
 }
 
-void Cache::read(uint32_t addr, uint32_t expected_data) {
+CacheStats CacheModel::total_stats() const {
+    CacheStats total;
+    for (const auto& set : stats) {
+        total += set;
+    }
+    return total;
+}
+
+void CacheModel::absorb_sets(const CacheModel& part, std::uint32_t first, std::uint32_t last) {
+    std::copy(part.stats.begin() + first, part.stats.begin() + last, stats.begin() + first);
+    for (std::size_t way = 0; way < victims.size(); ++way) {
+        victims[way] += part.victims[way];
+    }
+    memory.merge(part.memory);
+}
+
+void CacheModel::count_miss(std::uint32_t addr, std::uint32_t index) {
+    auto& set = stats[index];
+    set.misses++;
+    if (touched_lines.insert(addr >> offset_bits).second) {
+        set.cold_misses++;
+    }
+}
+
+void CacheModel::count_eviction(std::uint32_t index, int way, const CacheLine& victim) {
+    auto& set = stats[index];
+    if (victim.valid) {
+        set.evictions++;
+        victims[way]++;
+        if (!victim.reused) {
+            set.dead_evictions++;
+        }
+        if (victim.modif) {
+            set.dirty_writebacks++;
+        }
+    }
+}
+
+// измененная строка при вытеснении записывается в память по адресу начала строки
+void CacheModel::write_back(std::uint32_t index, const CacheLine& line) {
+    auto evicted_addr = (line.tag << (index_bits + offset_bits)) | (index << offset_bits);
+    memory.write(evicted_addr, line.data);
+
+    if (!quiet) {
+        std::cout << "Writing back to RAM: address=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << evicted_addr
+                  << " data=0x"
+                  << std::hex << std::setfill('0') << line.data << std::endl;
+    }
+}
+
+template <typename Policy>
+void Cache<Policy>::read(uint32_t addr, uint32_t expected_data) {
     auto index = get_index(addr);
     auto tag = get_tag(addr);
     auto way = get_way(addr);
-    access_counter++;
+    stats[index].reads++;
 
-    std::cout << "Read from addr: 0x"
-              << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
-
-    auto& line = sets[index].get_line(way);
-    if (!line.initialized) {
-        std::cerr << "Error: Attempt to read uninitialized data at address: 0x"
+    if (!quiet) {
+        std::cout << "Read from addr: 0x"
                   << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
-        exit(1);
+    }
+
+    auto line = line_at(index, way);
+    if (!line.valid) {
+        std::ostringstream message;
+        message << "Error: Attempt to read uninitialized data at address: 0x"
+                << std::hex << std::setw(8) << std::setfill('0') << addr;
+        throw TraceError(message.str());
     }
 
     if (line.valid && line.tag == tag) {
 
-        line.last_used = access_counter;
+        mark_hit(index, way);
+        policy.on_hit(index, way);
+        stats[index].hits++;
 
-        std::cout << "Cache hit: tag=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << tag
-                  << " index="
-                  << std::dec << index
-                  << " way="
-                  << std::dec << way << std::endl;
+        if (!quiet) {
+            std::cout << "Cache hit: tag=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << tag
+                      << " index="
+                      << std::dec << index
+                      << " way="
+                      << std::dec << way << std::endl;
+        }
 
         if (line.data != expected_data) {
-            std::cerr << "Data mismatch! Expected: 0x"
-                      << std::hex << std::setw(8) << std::setfill('0') << expected_data
-                      << ", Found: 0x"
-                      << std::hex << std::setw(8) << std::setfill('0') << line.data << std::endl;
-            exit(1);
+            throw data_mismatch(expected_data, line.data);
         }
 
-        std::cout << "Data returned to core: 0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << line.data << std::endl;
+        if (!quiet) {
+            std::cout << "Data returned to core: 0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << line.data << std::endl;
 
-        std::cout << "----------\n";
+            std::cout << "----------\n";
+        }
     } else {
-        if (line.valid) {
+        count_miss(addr, index);
+        count_eviction(index, way, line);
+
+        if (!quiet && line.valid) {
             auto evicted_addr = (line.tag << (index_bits + offset_bits)) | (index << offset_bits);
             if (line.modif) {
                 std::cout << "Evicting modified line: "
@@ -130,70 +466,84 @@ void Cache::read(uint32_t addr, uint32_t expected_data) {
             }
         }
 
-        std::mt19937 generator(std::random_device{}());
-        std::uniform_int_distribution<std::uint32_t> distribution(0, 0xFFFFFFFF);
+        if (line.valid && line.modif) {
+            write_back(index, line);
+        }
 
-        auto memory_data = distribution(generator);
-        std::cout << "RAM read: address=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << addr
-                  << " data=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << memory_data << std::endl;
+        // строка читается из памяти по адресу своего начала; в слово, куда еще не писали, загружается значение из трассы
+        auto line_addr = addr & ~((1u << offset_bits) - 1);
+        auto known = memory.written(line_addr);
+        auto memory_data = known ? memory.read(line_addr) : expected_data;
+        if (!quiet) {
+            std::cout << "RAM read: address=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << addr
+                      << " data=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << memory_data << std::endl;
+        }
 
-        line.tag = tag;
-        line.data = expected_data;
-        line.initialized = true;
-        line.valid = true;
-        line.modif = false;
-        line.last_used = access_counter;
+        if (known && memory_data != expected_data) {
+            throw data_mismatch(expected_data, memory_data);
+        }
 
-        std::cout << "Stored in cache: tag=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << tag
-                  << " index="
-                  << std::dec << index
-                  << " way=" << std::dec << way << std::endl;
+        store_line(index, way, tag, memory_data, false);
+        policy.on_fill(index, way);
 
-        std::cout << "Data returned to core: 0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << memory_data << std::endl;
+        if (!quiet) {
+            std::cout << "Stored in cache: tag=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << tag
+                      << " index="
+                      << std::dec << index
+                      << " way=" << std::dec << way << std::endl;
 
-        std::cout << "----------\n";
+            std::cout << "Data returned to core: 0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << memory_data << std::endl;
+
+            std::cout << "----------\n";
+        }
     }
 }
 
-void Cache::write(uint32_t addr, uint32_t data) {
+template <typename Policy>
+void Cache<Policy>::write(uint32_t addr, uint32_t data) {
     auto index = get_index(addr);
     auto tag = get_tag(addr);
-    access_counter++;
+    stats[index].writes++;
 
-    std::cout << "Write to addr: 0x"
-              << std::hex << std::setw(8) << std::setfill('0') << addr
-              << " data=0x"
-              << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+    if (!quiet) {
+        std::cout << "Write to addr: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr
+                  << " data=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+    }
 
     // существует ли уже строка с этим tag в наборе
-    auto way = sets[index].find_line(tag);
+    auto way = find_line(index, tag);
     if (way != -1) {
         // если строка с этим tag найдена
-        auto& line = sets[index].get_line(way);
+        line_data[static_cast<std::size_t>(index) * stride + way] = data;
+        dirty[index] |= std::uint64_t{1} << way;
+        mark_hit(index, way);
+        policy.on_hit(index, way);
+        stats[index].hits++;
 
-        line.data = data;
-        line.modif = true;
-        line.initialized = true;
-        line.last_used = access_counter;
+        if (!quiet) {
+            std::cout << "Cache hit - updated existing line: tag=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << tag
+                      << " index="
+                      << std::dec << index
+                      << " way="
+                      << std::dec << way << std::endl;
 
-        std::cout << "Cache hit - updated existing line: tag=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << tag
-                  << " index="
-                  << std::dec << index
-                  << " way="
-                  << std::dec << way << std::endl;
-
-        std::cout << "----------\n";
+            std::cout << "----------\n";
+        }
     } else {
         // tag не найден, значит производим вытеснение
-        way = sets[index].find_victim();
-        auto& evicted_line = sets[index].get_line(way);
+        way = find_victim(index);
+        auto evicted_line = line_at(index, way);
+        count_miss(addr, index);
+        count_eviction(index, way, evicted_line);
 
-        if (evicted_line.valid) {
+        if (!quiet && evicted_line.valid) {
             auto evicted_addr = (evicted_line.tag << (index_bits + offset_bits)) | (index << offset_bits);
             if (evicted_line.modif) {
                 std::cout << "Evicting modified line: "
@@ -207,11 +557,6 @@ void Cache::write(uint32_t addr, uint32_t data) {
                           << std::dec << way
                           << " data=0x"
                           << std::hex << std::setw(8) << std::setfill('0') << evicted_line.data << std::endl;
-
-                std::cout << "Writing back to RAM: address=0x"
-                          << std::hex << std::setw(8) << std::setfill('0') << evicted_addr
-                          << " data=0x"
-                          << std::hex << std::setfill('0') << evicted_line.data << std::endl;
             } else {
                 std::cout << "Evicting unmodified line: "
                           << "tag=0x"
@@ -223,20 +568,955 @@ void Cache::write(uint32_t addr, uint32_t data) {
             }
         }
 
-        evicted_line.tag = tag;
-        evicted_line.data = data;
-        evicted_line.initialized = true;
-        evicted_line.valid = true;
-        evicted_line.modif = true;
-        evicted_line.last_used = access_counter;
+        if (evicted_line.valid && evicted_line.modif) {
+            write_back(index, evicted_line);
+        }
+
+        store_line(index, way, tag, data, true);
+        policy.on_fill(index, way);
+
+        if (!quiet) {
+            std::cout << "Stored in cache: tag=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << tag
+                      << " index="
+                      << std::dec << index
+                      << " way="
+                      << std::dec << way << std::endl;
+
+            std::cout << "----------\n";
+        }
+    }
+}
+
+MixedPolicy::MixedPolicy(const std::string& name, int num_sets, int associativity)
+    : policies(make_policies(name, num_sets, associativity)) {}
+
+MixedPolicy::Policies MixedPolicy::make_policies(const std::string& name, int num_sets, int associativity) {
+    std::optional<Policies> result;
+    with_replacement_policy(name, [&](auto tag) {
+        using Policy = typename decltype(tag)::type;
+        result.emplace(std::in_place_type<Policy>, num_sets, associativity);
+    });
+    return std::move(*result);
+}
+
+namespace {
+
+// политика уровня и ее имя: MixedPolicy выбирается по имени из конфигурации, остальные политики заданы типом
+template <typename Policy>
+Policy make_level_policy(const std::string&, int num_sets, int associativity) {
+    return Policy(num_sets, associativity);
+}
+
+template <>
+MixedPolicy make_level_policy<MixedPolicy>(const std::string& name, int num_sets, int associativity) {
+    return MixedPolicy(name, num_sets, associativity);
+}
+
+template <typename Policy>
+const char* level_policy_name(const std::string&) {
+    return Policy::name;
+}
+
+template <>
+const char* level_policy_name<MixedPolicy>(const std::string& name) {
+    const char* result = nullptr;
+    with_replacement_policy(name, [&](auto tag) { result = decltype(tag)::type::name; });
+    return result;
+}
+
+} // namespace
+
+template <typename Policy>
+CacheLevel<Policy>::CacheLevel(const std::string& name, int cache_size, int line_size, int associativity, const std::string& policy_name)
+    : CacheModel(cache_size, line_size, associativity, level_policy_name<Policy>(policy_name), true),
+      policy(make_level_policy<Policy>(policy_name, num_sets, associativity)), name(name), shared(num_sets, 0) {}
+
+template <typename Policy>
+int CacheLevel<Policy>::request(std::uint32_t addr, bool write) {
+    auto index = get_index(addr);
+    auto way = find_line(index, get_tag(addr));
+    if (write) {
+        stats[index].writes++;
+    } else {
+        stats[index].reads++;
+    }
+
+    if (way == -1) {
+        count_miss(addr, index);
+        return -1;
+    }
+    mark_hit(index, way);
+    policy.on_hit(index, way);
+    stats[index].hits++;
+    return way;
+}
+
+template <typename Policy>
+LevelFill CacheLevel<Policy>::fill(std::uint32_t addr, bool dirty, bool shared_copy) {
+    auto index = get_index(addr);
+    LevelFill result;
+    result.way = free_way(index);
+    if (result.way == -1) {
+        result.way = policy.victim(index);
+        auto victim = line_at(index, result.way);
+        count_eviction(index, result.way, victim);
+        result.evicted = true;
+        result.evicted_dirty = victim.modif;
+        result.evicted_addr = line_address(index, victim.tag);
+    }
+    store_line(index, result.way, get_tag(addr), 0, dirty);
+    auto bit = std::uint64_t{1} << result.way;
+    shared[index] = shared_copy ? shared[index] | bit : shared[index] & ~bit;
+    policy.on_fill(index, result.way);
+    return result;
+}
+
+template <typename Policy>
+bool CacheLevel<Policy>::mark_dirty(std::uint32_t addr) {
+    auto index = get_index(addr);
+    auto way = find_line(index, get_tag(addr));
+    if (way == -1) {
+        return false;
+    }
+    dirty[index] |= std::uint64_t{1} << way;
+    return true;
+}
+
+template <typename Policy>
+bool CacheLevel<Policy>::remove(std::uint32_t addr, bool& was_dirty) {
+    auto index = get_index(addr);
+    auto way = find_line(index, get_tag(addr));
+    if (way == -1) {
+        return false;
+    }
+    was_dirty = (dirty[index] >> way) & 1;
+    clear_line(index, way);
+    shared[index] &= ~(std::uint64_t{1} << way);
+    return true;
+}
+
+template <typename Policy>
+bool CacheLevel<Policy>::line_state(std::uint32_t addr, bool& is_dirty, bool& is_shared) const {
+    auto index = get_index(addr);
+    auto way = find_line(index, get_tag(addr));
+    if (way == -1) {
+        return false;
+    }
+    is_dirty = (dirty[index] >> way) & 1;
+    is_shared = (shared[index] >> way) & 1;
+    return true;
+}
+
+template <typename Policy>
+bool CacheLevel<Policy>::set_line_state(std::uint32_t addr, bool is_dirty, bool is_shared) {
+    auto index = get_index(addr);
+    auto way = find_line(index, get_tag(addr));
+    if (way == -1) {
+        return false;
+    }
+    auto bit = std::uint64_t{1} << way;
+    dirty[index] = is_dirty ? dirty[index] | bit : dirty[index] & ~bit;
+    shared[index] = is_shared ? shared[index] | bit : shared[index] & ~bit;
+    return true;
+}
+
+Inclusion parse_inclusion(const std::string& name) {
+    if (name == "inclusive") {
+        return Inclusion::inclusive;
+    } else if (name == "exclusive") {
+        return Inclusion::exclusive;
+    } else if (name == "nine") {
+        return Inclusion::nine;
+    }
+    throw std::invalid_argument("Invalid inclusion policy: " + name + ". There're only 3 policies: inclusive/exclusive/nine");
+}
+
+const char* inclusion_name(Inclusion inclusion) {
+    switch (inclusion) {
+    case Inclusion::inclusive:
+        return "inclusive";
+    case Inclusion::exclusive:
+        return "exclusive";
+    default:
+        return "nine";
+    }
+}
+
+CacheHierarchy::CacheHierarchy(std::vector<std::unique_ptr<CacheLevel<MixedPolicy>>> levels, Inclusion inclusion, bool quiet)
+    : levels(std::move(levels)), inclusion(inclusion), quiet(quiet) {
+    if (this->levels.empty()) {
+        throw std::invalid_argument("cache hierarchy needs at least one level");
+    }
+    for (std::size_t i = 1; i < this->levels.size(); ++i) {
+        const auto& upper = *this->levels[i - 1];
+        const auto& lower = *this->levels[i];
+        if (inclusion == Inclusion::exclusive && lower.line_bytes() != upper.line_bytes()) {
+            throw std::invalid_argument("exclusive hierarchy needs the same line_size on all levels (" + upper.level_name() + " and " + lower.level_name() + " differ)");
+        }
+        if (lower.line_bytes() < upper.line_bytes()) {
+            throw std::invalid_argument("line_size of " + lower.level_name() + " is smaller than line_size of " + upper.level_name());
+        }
+    }
+}
+
+void CacheHierarchy::read(std::uint32_t addr, std::uint32_t expected_data) {
+    if (!quiet) {
+        std::cout << "Read from addr: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
+    }
+
+    access(addr, false);
+
+    // слово, в которое еще не писали, берется из трассы
+    auto known = memory.written(addr);
+    auto data = known ? memory.read(addr) : expected_data;
+    if (known && data != expected_data) {
+        throw data_mismatch(expected_data, data);
+    }
+
+    if (!quiet) {
+        std::cout << "Data returned to core: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+
+        std::cout << "----------\n";
+    }
+}
+
+void CacheHierarchy::write(std::uint32_t addr, std::uint32_t data) {
+    if (!quiet) {
+        std::cout << "Write to addr: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr
+                  << " data=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+    }
+
+    access(addr, true);
+    memory.write(addr, data);
+
+    if (!quiet) {
+        std::cout << "----------\n";
+    }
+}
+
+// запрос идет вниз до первого попадания, затем строка загружается в уровни выше него:
+// в инклюзивной и NINE иерархии - во все (снизу вверх, чтобы вытеснения нижних уровней успели инвалидировать верхние),
+// в эксклюзивной - только в L1, а из уровня попадания строка удаляется
+void CacheHierarchy::access(std::uint32_t addr, bool write) {
+    auto hit_level = levels.size();
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        auto way = levels[i]->request(addr, write);
+        if (!quiet) {
+            auto line = levels[i]->line_base(addr);
+            std::cout << levels[i]->level_name() << (way != -1 ? " hit" : " miss") << ": line=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << line;
+            if (way != -1) {
+                std::cout << " way=" << std::dec << way;
+            }
+            std::cout << std::endl;
+        }
+        if (way != -1) {
+            hit_level = i;
+            break;
+        }
+    }
+
+    auto dirty = write;
+    if (hit_level == levels.size()) {
+        ram_reads++;
+        if (!quiet) {
+            std::cout << "RAM read: address=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << levels.back()->line_base(addr) << std::endl;
+        }
+    } else if (hit_level == 0) {
+        if (write) {
+            levels[0]->mark_dirty(addr);
+        }
+        return;
+    } else if (inclusion == Inclusion::exclusive) {
+        auto moved_dirty = false;
+        levels[hit_level]->remove(addr, moved_dirty);
+        dirty = dirty || moved_dirty;
+    }
+
+    if (inclusion == Inclusion::exclusive) {
+        fill(0, addr, dirty);
+        return;
+    }
+    for (auto level = hit_level; level-- > 0;) {
+        fill(level, addr, level == 0 && dirty);
+    }
+}
+
+void CacheHierarchy::fill(std::size_t level, std::uint32_t addr, bool dirty) {
+    auto& cache = *levels[level];
+    auto result = cache.fill(addr, dirty);
+    if (result.evicted) {
+        evict(level, result.evicted_addr, result.evicted_dirty);
+    }
+    if (!quiet) {
+        std::cout << "Stored in " << cache.level_name() << ": line=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr)
+                  << " way=" << std::dec << result.way << std::endl;
+    }
+}
+
+void CacheHierarchy::evict(std::size_t level, std::uint32_t addr, bool dirty) {
+    const auto& cache = *levels[level];
+
+    if (inclusion == Inclusion::inclusive) {
+        // копии строки в уровнях выше (их строки не длиннее) удаляются, их изменения переходят в вытесняемую строку
+        for (std::size_t upper = 0; upper < level; ++upper) {
+            auto& upper_cache = *levels[upper];
+            for (std::uint32_t offset = 0; offset < static_cast<std::uint32_t>(cache.line_bytes()); offset += upper_cache.line_bytes()) {
+                auto upper_dirty = false;
+                if (!upper_cache.remove(addr + offset, upper_dirty)) {
+                    continue;
+                }
+                upper_cache.count_back_invalidation();
+                dirty = dirty || upper_dirty;
+                if (!quiet) {
+                    std::cout << upper_cache.level_name() << " back-invalidation: address=0x"
+                              << std::hex << std::setw(8) << std::setfill('0') << addr + offset << std::endl;
+                }
+            }
+        }
+    }
+
+    if (!quiet) {
+        std::cout << cache.level_name() << (dirty ? " evicting modified line: address=0x" : " evicting unmodified line: address=0x")
+                  << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
+    }
+
+    if (inclusion == Inclusion::exclusive && level + 1 < levels.size()) {
+        fill(level + 1, addr, dirty);
+    } else if (dirty) {
+        write_back(level, addr);
+    }
+}
+
+// измененная строка записывается в ближайший уровень ниже, где она есть, иначе - в память
+void CacheHierarchy::write_back(std::size_t level, std::uint32_t addr) {
+    for (auto lower = level + 1; lower < levels.size(); ++lower) {
+        if (levels[lower]->mark_dirty(addr)) {
+            if (!quiet) {
+                std::cout << "Writing back to " << levels[lower]->level_name() << ": address=0x"
+                          << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
+            }
+            return;
+        }
+    }
+    ram_writebacks++;
+    if (!quiet) {
+        std::cout << "Writing back to RAM: address=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
+    }
+}
+
+CacheHierarchy load_cache_hierarchy(const pt::ptree& descr, bool quiet) {
+    auto inclusion = parse_inclusion(descr.get<std::string>("inclusion", "inclusive"));
+
+    std::vector<std::unique_ptr<CacheLevel<MixedPolicy>>> levels;
+    for (const auto& item : descr.get_child("levels")) {
+        const auto& level = item.second;
+        auto name = level.get<std::string>("name", "L" + std::to_string(levels.size() + 1));
+        auto line_size = level.get<int>("line_size");
+        auto associativity = level.get<int>("associativity");
+        auto cache_size = level.get<int>("cache_size");
+        auto policy = level.get<std::string>("replacement_policy", LruPolicy::name);
+
+        levels.push_back(std::make_unique<CacheLevel<MixedPolicy>>(name, cache_size, line_size, associativity, policy));
+    }
+
+    return CacheHierarchy(std::move(levels), inclusion, quiet);
+}
+
+Coherence parse_coherence(const std::string& name) {
+    if (name == "mesi") {
+        return Coherence::mesi;
+    } else if (name == "moesi") {
+        return Coherence::moesi;
+    }
+    throw std::invalid_argument("Invalid coherence protocol: " + name + ". There're only 2 protocols: mesi/moesi");
+}
+
+const char* coherence_name(Coherence protocol) {
+    return protocol == Coherence::mesi ? "mesi" : "moesi";
+}
+
+template <typename Policy>
+CoherentCaches<Policy>::CoherentCaches(std::vector<CacheLevel<Policy>> caches, Coherence protocol, bool quiet)
+    : caches(std::move(caches)), protocol(protocol), quiet(quiet), events(this->caches.size()) {
+    if (this->caches.empty() || this->caches.size() > 64) {
+        throw std::invalid_argument("number of cores must be in range [1, 64]");
+    }
+}
+
+template <typename Policy>
+typename CoherentCaches<Policy>::SharingHistory& CoherentCaches<Policy>::history(std::uint32_t line) {
+    auto& entry = sharing[line];
+    if (entry.written_words.empty()) {
+        entry.counters.addr = line;
+        entry.written_words.assign(caches.size(), 0);
+    }
+    return entry;
+}
+
+// слово строки (по 4 байта); в строках длиннее 256 байт слова с номерами, отличающимися на 64, не различаются
+template <typename Policy>
+std::uint64_t CoherentCaches<Policy>::word_bit(std::uint32_t addr) const {
+    auto offset = addr & static_cast<std::uint32_t>(caches[0].line_bytes() - 1);
+    return std::uint64_t{1} << ((offset >> 2) & 63);
+}
+
+template <typename Policy>
+void CoherentCaches<Policy>::classify_miss(std::uint32_t core, std::uint32_t addr) {
+    auto found = sharing.find(caches[core].line_base(addr));
+    if (found == sharing.end()) {
+        return;
+    }
+    auto& entry = found->second;
+    auto core_bit = std::uint64_t{1} << core;
+    entry.counters.cores |= core_bit;
+    if (!(entry.lost & core_bit)) {
+        return;
+    }
+
+    entry.lost &= ~core_bit;
+    events[core].coherence_misses++;
+    if (entry.written_words[core] & word_bit(addr)) {
+        events[core].true_sharing_misses++;
+        entry.counters.true_sharing_misses++;
+    } else {
+        events[core].false_sharing_misses++;
+        entry.counters.false_sharing_misses++;
+    }
+    entry.written_words[core] = 0;
+}
+
+template <typename Policy>
+bool CoherentCaches<Policy>::invalidate_others(std::uint32_t core, std::uint32_t addr) {
+    auto line = caches[core].line_base(addr);
+    auto dirty_copy = false;
+    for (std::uint32_t other = 0; other < caches.size(); ++other) {
+        auto dirty = false;
+        if (other == core || !caches[other].remove(addr, dirty)) {
+            continue;
+        }
+        dirty_copy = dirty_copy || dirty;
+        events[other].invalidations_received++;
+        events[core].invalidations_sent++;
+
+        auto& entry = history(line);
+        entry.lost |= std::uint64_t{1} << other;
+        entry.written_words[other] = 0;
+        entry.counters.invalidations++;
+        entry.counters.cores |= (std::uint64_t{1} << other) | (std::uint64_t{1} << core);
+
+        if (!quiet) {
+            std::cout << caches[other].level_name() << " invalidated: line=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << line << std::endl;
+        }
+    }
+    return dirty_copy;
+}
+
+template <typename Policy>
+void CoherentCaches<Policy>::print_transition(std::uint32_t core, const char* event, std::uint32_t addr, bool dirty, bool shared) const {
+    if (quiet) {
+        return;
+    }
+    std::cout << caches[core].level_name() << " " << event << ": line=0x"
+              << std::hex << std::setw(8) << std::setfill('0') << caches[core].line_base(addr)
+              << " state=" << (dirty ? (shared ? 'O' : 'M') : (shared ? 'S' : 'E')) << std::endl;
+}
+
+template <typename Policy>
+void CoherentCaches<Policy>::fill(std::uint32_t core, std::uint32_t addr, bool dirty, bool shared) {
+    auto& cache = caches[core];
+    auto result = cache.fill(addr, dirty, shared);
+    if (result.evicted) {
+        if (!quiet) {
+            std::cout << cache.level_name() << (result.evicted_dirty ? " evicting modified line: address=0x" : " evicting unmodified line: address=0x")
+                      << std::hex << std::setw(8) << std::setfill('0') << result.evicted_addr << std::endl;
+        }
+        // M и O - единственная актуальная копия, она записывается в память
+        if (result.evicted_dirty) {
+            ram_writebacks++;
+            if (!quiet) {
+                std::cout << "Writing back to RAM: address=0x"
+                          << std::hex << std::setw(8) << std::setfill('0') << result.evicted_addr << std::endl;
+            }
+        }
+    }
+    print_transition(core, "stored", addr, dirty, shared);
+}
+
+template <typename Policy>
+void CoherentCaches<Policy>::read(std::uint32_t core, std::uint32_t addr, std::uint32_t expected_data) {
+    if (core >= caches.size()) {
+        throw std::invalid_argument("Invalid core ID: " + std::to_string(core));
+    }
+    if (!quiet) {
+        std::cout << caches[core].level_name() << " read from addr: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr << std::endl;
+    }
+
+    auto& cache = caches[core];
+    if (cache.request(addr, false) != -1) {
+        auto dirty = false;
+        auto shared = false;
+        cache.line_state(addr, dirty, shared);
+        print_transition(core, "hit", addr, dirty, shared);
+    } else {
+        if (!quiet) {
+            std::cout << cache.level_name() << " miss: line=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr) << std::endl;
+        }
+        classify_miss(core, addr);
 
-        std::cout << "Stored in cache: tag=0x"
-                  << std::hex << std::setw(8) << std::setfill('0') << tag
-                  << " index="
-                  << std::dec << index
-                  << " way="
-                  << std::dec << way << std::endl;
+        // BusRd: измененную копию отдает ее владелец (в MESI - с записью в память и переходом в S, в MOESI - оставаясь
+        // владельцем в O), копия E становится S
+        auto shared_copy = false;
+        auto supplied = false;
+        for (std::uint32_t other = 0; other < caches.size(); ++other) {
+            auto dirty = false;
+            auto shared = false;
+            if (other == core || !caches[other].line_state(addr, dirty, shared)) {
+                continue;
+            }
+            shared_copy = true;
+            if (dirty) {
+                supplied = true;
+                events[other].interventions++;
+                auto keep_dirty = protocol == Coherence::moesi;
+                caches[other].set_line_state(addr, keep_dirty, true);
+                print_transition(other, "intervention", addr, keep_dirty, true);
+                if (!keep_dirty) {
+                    ram_writebacks++;
+                    if (!quiet) {
+                        std::cout << "Writing back to RAM: address=0x"
+                                  << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr) << std::endl;
+                    }
+                }
+            } else if (!shared) {
+                caches[other].set_line_state(addr, false, true);
+                print_transition(other, "snoop", addr, false, true);
+            }
+        }
 
+        if (!supplied) {
+            ram_reads++;
+            if (!quiet) {
+                std::cout << "RAM read: address=0x"
+                          << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr) << std::endl;
+            }
+        }
+        fill(core, addr, false, shared_copy);
+    }
+
+    // слово, в которое еще не писали, берется из трассы
+    auto known = memory.written(addr);
+    auto data = known ? memory.read(addr) : expected_data;
+    if (known && data != expected_data) {
+        throw data_mismatch(expected_data, data);
+    }
+
+    if (!quiet) {
+        std::cout << "Data returned to core: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+
+        std::cout << "----------\n";
+    }
+}
+
+template <typename Policy>
+void CoherentCaches<Policy>::write(std::uint32_t core, std::uint32_t addr, std::uint32_t data) {
+    if (core >= caches.size()) {
+        throw std::invalid_argument("Invalid core ID: " + std::to_string(core));
+    }
+    if (!quiet) {
+        std::cout << caches[core].level_name() << " write to addr: 0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << addr
+                  << " data=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+    }
+
+    auto& cache = caches[core];
+    auto dirty = false;
+    auto shared = false;
+    auto present = cache.line_state(addr, dirty, shared);
+    cache.request(addr, true);
+
+    if (present) {
+        // S и O: BusUpgr инвалидирует остальные копии (данные уже есть), E переходит в M без транзакции
+        if (shared) {
+            events[core].upgrade_misses++;
+            invalidate_others(core, addr);
+        }
+        cache.set_line_state(addr, true, false);
+        print_transition(core, shared ? "upgrade" : "hit", addr, true, false);
+    } else {
+        if (!quiet) {
+            std::cout << cache.level_name() << " miss: line=0x"
+                      << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr) << std::endl;
+        }
+        classify_miss(core, addr);
+
+        // BusRdX: все копии инвалидируются, измененную строку отдает ее владелец
+        auto owner = caches.size();
+        for (std::uint32_t other = 0; other < caches.size(); ++other) {
+            auto other_dirty = false;
+            auto other_shared = false;
+            if (other != core && caches[other].line_state(addr, other_dirty, other_shared) && other_dirty) {
+                owner = other;
+            }
+        }
+        invalidate_others(core, addr);
+        if (owner != caches.size()) {
+            events[owner].interventions++;
+        } else {
+            ram_reads++;
+            if (!quiet) {
+                std::cout << "RAM read: address=0x"
+                          << std::hex << std::setw(8) << std::setfill('0') << cache.line_base(addr) << std::endl;
+            }
+        }
+        fill(core, addr, true, false);
+    }
+
+    // запись видна ядрам, потерявшим строку: их следующий промах по этому слову - истинное разделение
+    auto found = sharing.find(cache.line_base(addr));
+    if (found != sharing.end()) {
+        auto& entry = found->second;
+        entry.counters.cores |= std::uint64_t{1} << core;
+        for (auto lost = entry.lost & ~(std::uint64_t{1} << core); lost; lost &= lost - 1) {
+            entry.written_words[__builtin_ctzll(lost)] |= word_bit(addr);
+        }
+    }
+    memory.write(addr, data);
+
+    if (!quiet) {
         std::cout << "----------\n";
     }
 }
+
+template <typename Policy>
+std::vector<LineSharing> CoherentCaches<Policy>::hot_lines(std::size_t limit) const {
+    std::vector<LineSharing> lines;
+    for (const auto& item : sharing) {
+        lines.push_back(item.second.counters);
+    }
+    std::sort(lines.begin(), lines.end(), [](const LineSharing& a, const LineSharing& b) {
+        if (a.false_sharing_misses != b.false_sharing_misses) {
+            return a.false_sharing_misses > b.false_sharing_misses;
+        }
+        if (a.invalidations != b.invalidations) {
+            return a.invalidations > b.invalidations;
+        }
+        return a.addr < b.addr;
+    });
+    if (lines.size() > limit) {
+        lines.resize(limit);
+    }
+    return lines;
+}
+
+template <typename Policy>
+CoherentCaches<Policy> load_coherent_caches(const pt::ptree& root, bool quiet) {
+    auto cores = root.get<int>("coherence.cores");
+    auto protocol = parse_coherence(root.get<std::string>("coherence.protocol", "mesi"));
+
+    auto line_size = root.get<int>("cache_descr.line_size");
+    auto associativity = root.get<int>("cache_descr.associativity");
+    auto cache_size = root.get<int>("cache_descr.cache_size");
+
+    if (cores <= 0 || cores > 64) {
+        throw std::invalid_argument("number of cores must be in range [1, 64]");
+    }
+
+    std::vector<CacheLevel<Policy>> caches;
+    caches.reserve(cores);
+    for (int core = 0; core < cores; ++core) {
+        caches.emplace_back("Core " + std::to_string(core), cache_size, line_size, associativity);
+    }
+    return CoherentCaches<Policy>(std::move(caches), protocol, quiet);
+}
+
+namespace {
+
+void print_stats_text(std::ostream& out, const CacheStats& stats) {
+    out << "reads=" << stats.reads
+        << " writes=" << stats.writes
+        << " hits=" << stats.hits
+        << " misses=" << stats.misses
+        << " cold_misses=" << stats.cold_misses
+        << " evictions=" << stats.evictions
+        << " dirty_writebacks=" << stats.dirty_writebacks
+        << " dead_evictions=" << stats.dead_evictions;
+}
+
+void print_stats_json(std::ostream& out, const CacheStats& stats) {
+    out << "{\"reads\": " << stats.reads
+        << ", \"writes\": " << stats.writes
+        << ", \"hits\": " << stats.hits
+        << ", \"misses\": " << stats.misses
+        << ", \"cold_misses\": " << stats.cold_misses
+        << ", \"evictions\": " << stats.evictions
+        << ", \"dirty_writebacks\": " << stats.dirty_writebacks
+        << ", \"dead_evictions\": " << stats.dead_evictions << "}";
+}
+
+void print_coherence_text(std::ostream& out, const CoherenceStats& stats) {
+    out << "upgrade_misses=" << stats.upgrade_misses
+        << " invalidations_sent=" << stats.invalidations_sent
+        << " invalidations_received=" << stats.invalidations_received
+        << " interventions=" << stats.interventions
+        << " coherence_misses=" << stats.coherence_misses
+        << " true_sharing_misses=" << stats.true_sharing_misses
+        << " false_sharing_misses=" << stats.false_sharing_misses;
+}
+
+void print_coherence_json(std::ostream& out, const CoherenceStats& stats) {
+    out << "{\"upgrade_misses\": " << stats.upgrade_misses
+        << ", \"invalidations_sent\": " << stats.invalidations_sent
+        << ", \"invalidations_received\": " << stats.invalidations_received
+        << ", \"interventions\": " << stats.interventions
+        << ", \"coherence_misses\": " << stats.coherence_misses
+        << ", \"true_sharing_misses\": " << stats.true_sharing_misses
+        << ", \"false_sharing_misses\": " << stats.false_sharing_misses << "}";
+}
+
+// строки с промахами ложного разделения - первые кандидаты на выравнивание и разнесение данных по строкам
+constexpr std::size_t hot_line_limit = 10;
+
+double hit_rate(const CacheStats& stats) {
+    return stats.reads + stats.writes ? static_cast<double>(stats.hits) / (stats.reads + stats.writes) : 0.0;
+}
+
+void print_victim_ways_text(std::ostream& out, const std::vector<std::uint64_t>& victims) {
+    out << "Victim ways:";
+    for (size_t way = 0; way < victims.size(); ++way) {
+        out << " " << way << "=" << victims[way];
+    }
+    out << "\n";
+}
+
+void print_victim_ways_json(std::ostream& out, const std::vector<std::uint64_t>& victims) {
+    out << "[";
+    for (size_t way = 0; way < victims.size(); ++way) {
+        out << (way > 0 ? ", " : "") << victims[way];
+    }
+    out << "]";
+}
+
+} // namespace
+
+void print_stats(std::ostream& out, const CacheModel& cache, const std::string& format) {
+    auto total = cache.total_stats();
+    const auto& sets = cache.set_stats();
+    out << std::dec;
+
+    const auto& victims = cache.victim_ways();
+
+    if (format == "json") {
+        out << "{\n  \"policy\": \"" << cache.policy_name() << "\",\n  \"total\": ";
+        print_stats_json(out, total);
+        out << ",\n  \"hit_rate\": " << hit_rate(total)
+            << ",\n  \"memory_pages\": " << cache.backing_memory().allocated_pages()
+            << ",\n  \"victim_ways\": ";
+        print_victim_ways_json(out, victims);
+        out << ",\n  \"sets\": [";
+        for (size_t i = 0; i < sets.size(); ++i) {
+            out << (i > 0 ? ",\n    " : "\n    ");
+            print_stats_json(out, sets[i]);
+        }
+        out << "\n  ]\n}\n";
+        return;
+    }
+
+    out << "Policy: " << cache.policy_name() << "\n";
+    out << "Total: ";
+    print_stats_text(out, total);
+    out << "\nHit rate: " << hit_rate(total) << "\n";
+    out << "RAM pages allocated: " << cache.backing_memory().allocated_pages() << " (" << (1u << BackingMemory::page_bits) << " bytes each)\n";
+    print_victim_ways_text(out, victims);
+    for (size_t i = 0; i < sets.size(); ++i) {
+        out << "Set " << i << ": ";
+        print_stats_text(out, sets[i]);
+        out << "\n";
+    }
+}
+
+// статистика каждого уровня (как у одиночного кэша, плюс обратные инвалидации) и обмен с памятью
+void print_stats(std::ostream& out, const CacheHierarchy& hierarchy, const std::string& format) {
+    const auto& levels = hierarchy.cache_levels();
+    out << std::dec;
+
+    if (format == "json") {
+        out << "{\n  \"inclusion\": \"" << inclusion_name(hierarchy.inclusion_policy()) << "\",\n  \"levels\": [";
+        for (size_t i = 0; i < levels.size(); ++i) {
+            const auto& level = *levels[i];
+            auto total = level.total_stats();
+            const auto& sets = level.set_stats();
+            out << (i > 0 ? ",\n    {" : "\n    {")
+                << "\"name\": \"" << level.level_name() << "\", \"policy\": \"" << level.policy_name() << "\", \"total\": ";
+            print_stats_json(out, total);
+            out << ", \"hit_rate\": " << hit_rate(total)
+                << ", \"back_invalidations\": " << level.back_invalidations()
+                << ", \"victim_ways\": ";
+            print_victim_ways_json(out, level.victim_ways());
+            out << ", \"sets\": [";
+            for (size_t set = 0; set < sets.size(); ++set) {
+                out << (set > 0 ? ",\n      " : "\n      ");
+                print_stats_json(out, sets[set]);
+            }
+            out << "\n    ]}";
+        }
+        out << "\n  ],\n  \"memory_reads\": " << hierarchy.memory_reads()
+            << ",\n  \"memory_writebacks\": " << hierarchy.memory_writebacks()
+            << ",\n  \"memory_pages\": " << hierarchy.backing_memory().allocated_pages() << "\n}\n";
+        return;
+    }
+
+    out << "Inclusion: " << inclusion_name(hierarchy.inclusion_policy()) << "\n";
+    for (const auto& level : levels) {
+        auto total = level->total_stats();
+        const auto& sets = level->set_stats();
+        out << "Level " << level->level_name() << "\n";
+        out << "Policy: " << level->policy_name() << "\n";
+        out << "Total: ";
+        print_stats_text(out, total);
+        out << "\nHit rate: " << hit_rate(total) << "\n";
+        out << "Back-invalidations: " << level->back_invalidations() << "\n";
+        print_victim_ways_text(out, level->victim_ways());
+        for (size_t i = 0; i < sets.size(); ++i) {
+            out << "Set " << i << ": ";
+            print_stats_text(out, sets[i]);
+            out << "\n";
+        }
+    }
+    out << "RAM reads: " << hierarchy.memory_reads() << "\n";
+    out << "RAM writebacks: " << hierarchy.memory_writebacks() << "\n";
+    out << "RAM pages allocated: " << hierarchy.backing_memory().allocated_pages() << " (" << (1u << BackingMemory::page_bits) << " bytes each)\n";
+}
+
+template <typename Policy>
+void print_stats(std::ostream& out, const CoherentCaches<Policy>& system, const std::string& format) {
+    const auto& caches = system.core_caches();
+    const auto& events = system.coherence_stats();
+    auto hot_lines = system.hot_lines(hot_line_limit);
+    out << std::dec;
+
+    if (format == "json") {
+        out << "{\n  \"protocol\": \"" << coherence_name(system.protocol_kind()) << "\",\n  \"cores\": [";
+        for (size_t core = 0; core < caches.size(); ++core) {
+            const auto& cache = caches[core];
+            auto total = cache.total_stats();
+            const auto& sets = cache.set_stats();
+            out << (core > 0 ? ",\n    {" : "\n    {")
+                << "\"core\": " << core << ", \"policy\": \"" << cache.policy_name() << "\", \"total\": ";
+            print_stats_json(out, total);
+            out << ", \"hit_rate\": " << hit_rate(total) << ", \"coherence\": ";
+            print_coherence_json(out, events[core]);
+            out << ", \"victim_ways\": ";
+            print_victim_ways_json(out, cache.victim_ways());
+            out << ", \"sets\": [";
+            for (size_t set = 0; set < sets.size(); ++set) {
+                out << (set > 0 ? ",\n      " : "\n      ");
+                print_stats_json(out, sets[set]);
+            }
+            out << "\n    ]}";
+        }
+        out << "\n  ],\n  \"memory_reads\": " << system.memory_reads()
+            << ",\n  \"memory_writebacks\": " << system.memory_writebacks()
+            << ",\n  \"memory_pages\": " << system.backing_memory().allocated_pages()
+            << ",\n  \"hot_lines\": [";
+        for (size_t i = 0; i < hot_lines.size(); ++i) {
+            const auto& line = hot_lines[i];
+            out << (i > 0 ? ",\n    " : "\n    ") << "{\"line\": " << line.addr << ", \"cores\": [";
+            auto first = true;
+            for (auto cores = line.cores; cores; cores &= cores - 1) {
+                out << (first ? "" : ", ") << __builtin_ctzll(cores);
+                first = false;
+            }
+            out << "], \"invalidations\": " << line.invalidations
+                << ", \"true_sharing_misses\": " << line.true_sharing_misses
+                << ", \"false_sharing_misses\": " << line.false_sharing_misses << "}";
+        }
+        out << (hot_lines.empty() ? "]\n}\n" : "\n  ]\n}\n");
+        return;
+    }
+
+    out << "Protocol: " << coherence_name(system.protocol_kind()) << "\n";
+    for (size_t core = 0; core < caches.size(); ++core) {
+        const auto& cache = caches[core];
+        auto total = cache.total_stats();
+        const auto& sets = cache.set_stats();
+        out << cache.level_name() << "\n";
+        out << "Policy: " << cache.policy_name() << "\n";
+        out << "Total: ";
+        print_stats_text(out, total);
+        out << "\nHit rate: " << hit_rate(total) << "\n";
+        out << "Coherence: ";
+        print_coherence_text(out, events[core]);
+        out << "\n";
+        print_victim_ways_text(out, cache.victim_ways());
+        for (size_t i = 0; i < sets.size(); ++i) {
+            out << "Set " << i << ": ";
+            print_stats_text(out, sets[i]);
+            out << "\n";
+        }
+    }
+    out << "RAM reads: " << system.memory_reads() << "\n";
+    out << "RAM writebacks: " << system.memory_writebacks() << "\n";
+    out << "RAM pages allocated: " << system.backing_memory().allocated_pages() << " (" << (1u << BackingMemory::page_bits) << " bytes each)\n";
+    out << "Hot lines:";
+    if (hot_lines.empty()) {
+        out << " none";
+    }
+    out << "\n";
+    for (const auto& line : hot_lines) {
+        out << "  line=0x" << std::hex << std::setw(8) << std::setfill('0') << line.addr << std::dec << " cores=";
+        auto first = true;
+        for (auto cores = line.cores; cores; cores &= cores - 1) {
+            out << (first ? "" : ",") << __builtin_ctzll(cores);
+            first = false;
+        }
+        out << " invalidations=" << line.invalidations
+            << " true_sharing_misses=" << line.true_sharing_misses
+            << " false_sharing_misses=" << line.false_sharing_misses << "\n";
+    }
+}
+
+// политики, доступные через cache_descr.replacement_policy (см. with_replacement_policy)
+
+template class Cache<LruPolicy>;
+template class Cache<PlruPolicy>;
+template class Cache<FifoPolicy>;
+template class Cache<RandomPolicy>;
+template class Cache<NruPolicy>;
+template class Cache<SrripPolicy>;
+template class Cache<BrripPolicy>;
+template class Cache<LfuPolicy>;
+
+// уровни иерархии
+template class CacheLevel<MixedPolicy>;
+
+// кэши ядер: политика одна на все ядра и задается параметром шаблона (см. with_replacement_policy)
+#define INSTANTIATE_COHERENT_CACHES(Policy) \
+    template class CacheLevel<Policy>; \
+    template class CoherentCaches<Policy>; \
+    template CoherentCaches<Policy> load_coherent_caches<Policy>(const pt::ptree& root, bool quiet); \
+    template void print_stats<Policy>(std::ostream& out, const CoherentCaches<Policy>& system, const std::string& format);
+
+INSTANTIATE_COHERENT_CACHES(LruPolicy)
+INSTANTIATE_COHERENT_CACHES(PlruPolicy)
+INSTANTIATE_COHERENT_CACHES(FifoPolicy)
+INSTANTIATE_COHERENT_CACHES(RandomPolicy)
+INSTANTIATE_COHERENT_CACHES(NruPolicy)
+INSTANTIATE_COHERENT_CACHES(SrripPolicy)
+INSTANTIATE_COHERENT_CACHES(BrripPolicy)
+INSTANTIATE_COHERENT_CACHES(LfuPolicy)
+
+#undef INSTANTIATE_COHERENT_CACHES
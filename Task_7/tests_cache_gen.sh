@@ -24,6 +24,29 @@ fi
 mkdir -p "$OUTPUT_DIR"
 TRACE_DIR="${OUTPUT_DIR}/traces"
 mkdir -p "$TRACE_DIR"
+STATS_DIR="${OUTPUT_DIR}/stats"
+mkdir -p "$STATS_DIR"
+CONFIG_DIR="${OUTPUT_DIR}/configs"
+mkdir -p "$CONFIG_DIR"
+
+# каждая трасса дополнительно проигрывается со всеми политиками вытеснения: последовательно и в JOBS потоков
+# (статистика должна совпасть), а также на иерархии из одного уровня той же геометрии (итог должен совпасть с cache_descr)
+POLICIES="lru plru fifo random nru srrip brrip lfu"
+JOBS=4
+FAILED=0
+
+config_value() {
+    grep -o "\"$1\"[[:space:]]*:[[:space:]]*[0-9]*" "$CACHE_DESCR" | grep -o '[0-9]*$'
+}
+LINE_SIZE=$(config_value line_size)
+ASSOCIATIVITY=$(config_value associativity)
+CACHE_SIZE=$(config_value cache_size)
+GEOMETRY="\"line_size\": ${LINE_SIZE}, \"associativity\": ${ASSOCIATIVITY}, \"cache_size\": ${CACHE_SIZE}"
+
+for POLICY in $POLICIES; do
+    echo "{\"cache_descr\": {${GEOMETRY}, \"replacement_policy\": \"${POLICY}\"}}" > "${CONFIG_DIR}/cache_${POLICY}.json"
+    echo "{\"cache_hierarchy\": {\"inclusion\": \"inclusive\", \"levels\": [{${GEOMETRY}, \"replacement_policy\": \"${POLICY}\"}]}}" > "${CONFIG_DIR}/hierarchy_${POLICY}.json"
+done
 
 for i in $(seq 1 "$NUM_TESTS"); do
     SEED=$((RANDOM))
@@ -34,6 +57,7 @@ for i in $(seq 1 "$NUM_TESTS"); do
     
     if [ $? -ne 0 ]; then
         echo "Test $i error: Failed to generate test $i with seed $SEED."
+        FAILED=$((FAILED + 1))
         continue  
     fi
 
@@ -41,10 +65,50 @@ for i in $(seq 1 "$NUM_TESTS"); do
     
     if [ $? -ne 0 ]; then
         echo "Test $i error: Cache simulator failed on test $i with seed $SEED."
+        FAILED=$((FAILED + 1))
         continue 
     fi
 
+    TEST_FAILED=0
+    for POLICY in $POLICIES; do
+        STATS_SERIAL="${STATS_DIR}/stats_${i}_${POLICY}.txt"
+        STATS_JOBS="${STATS_DIR}/stats_${i}_${POLICY}_jobs.txt"
+        STATS_HIERARCHY="${STATS_DIR}/stats_${i}_${POLICY}_hierarchy.txt"
+
+        if ! ../Task_6/build/cache_modelling --config "${CONFIG_DIR}/cache_${POLICY}.json" --input "$OUTPUT_FILE_GEN" --quiet --stats > "$STATS_SERIAL"; then
+            echo "Test $i error: Cache simulator failed with policy $POLICY."
+            TEST_FAILED=1
+            continue
+        fi
+
+        if ! ../Task_6/build/cache_modelling --config "${CONFIG_DIR}/cache_${POLICY}.json" --input "$OUTPUT_FILE_GEN" --quiet --stats --jobs "$JOBS" > "$STATS_JOBS"; then
+            echo "Test $i error: Cache simulator failed with policy $POLICY and --jobs $JOBS."
+            TEST_FAILED=1
+        elif ! diff -q "$STATS_SERIAL" "$STATS_JOBS" > /dev/null; then
+            echo "Test $i error: Statistics with policy $POLICY and --jobs $JOBS differ from the serial run."
+            TEST_FAILED=1
+        fi
+
+        if ! ../Task_6/build/cache_modelling --config "${CONFIG_DIR}/hierarchy_${POLICY}.json" --input "$OUTPUT_FILE_GEN" --quiet --stats > "$STATS_HIERARCHY"; then
+            echo "Test $i error: Cache simulator failed on the one-level hierarchy with policy $POLICY."
+            TEST_FAILED=1
+        elif [ "$(grep '^Total:' "$STATS_SERIAL")" != "$(grep '^Total:' "$STATS_HIERARCHY")" ]; then
+            echo "Test $i error: Totals of the one-level hierarchy with policy $POLICY differ from cache_descr."
+            TEST_FAILED=1
+        fi
+    done
+
+    if [ "$TEST_FAILED" -ne 0 ]; then
+        FAILED=$((FAILED + 1))
+        continue
+    fi
+
     echo "Test $i with seed $SEED completed successfully."
 done
 
 echo "End."
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "$FAILED of $NUM_TESTS tests failed."
+    exit 1
+fi